@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+#define CACHE_BUCKETS 4096
+
+/* States of an entry */
+enum{
+	ENTRY_PENDING,	/* registered by cache_join, its header not yet known */
+	ENTRY_FILLING,	/* its size is known and its bytes arrive */
+	ENTRY_CACHED,	/* filled and in the cache */
+	ENTRY_FILLED,	/* filled, too large for the cache and dropped from the table */
+	ENTRY_FAILED	/* dropped from the table; what was filled stays readable */
+};
+
+struct cache_entry_t{
+	char *key;
+	int state;	/* under cache_lock */
+	int status;	/* from cache_answer, 0 if the origin sent a file */
+	size_t size;
+	size_t filled;	/* bytes written so far; under cache_lock */
+	int has_digest;
+	uint32_t digest;
+	char *data;	/* the file in memory, NULL if it is in fildes */
+	int fildes;	/* unlinked file in the cache directory, or -1 */
+	int refs;	/* one while in the table, plus one per holder; under cache_lock */
+	pthread_cond_t changed;	/* signalled as the entry fills, is cached or fails */
+	cache_entry_t *next;	/* hash chain */
+	cache_entry_t *prev_use;	/* eviction list of cached entries, newest or most recently used first */
+	cache_entry_t *next_use;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry_t *buckets[CACHE_BUCKETS];
+static cache_entry_t *use_head;
+static cache_entry_t *use_tail;
+static size_t capacity;
+static size_t used;
+static int lru;	/* hits move entries to the front */
+static char *cachedir;
+
+static unsigned int _hash(const char *key){
+	unsigned int hash = 2166136261u;
+
+	while(*key)
+		hash = (hash ^ (unsigned char) *key++) * 16777619u;
+	return hash & (CACHE_BUCKETS - 1);
+}
+
+static void _entryfree(cache_entry_t *entry){
+	if(0 <= entry->fildes)
+		close(entry->fildes);
+	free(entry->data);
+	free(entry->key);
+	pthread_cond_destroy(&entry->changed);
+	free(entry);
+}
+
+static void _useremove(cache_entry_t *entry){
+	if(entry->prev_use) entry->prev_use->next_use = entry->next_use;
+	else use_head = entry->next_use;
+	if(entry->next_use) entry->next_use->prev_use = entry->prev_use;
+	else use_tail = entry->prev_use;
+	entry->prev_use = entry->next_use = NULL;
+}
+
+static void _usepush(cache_entry_t *entry){
+	entry->prev_use = NULL;
+	entry->next_use = use_head;
+	if(use_head) use_head->prev_use = entry;
+	else use_tail = entry;
+	use_head = entry;
+}
+
+static cache_entry_t *_find(const char *key){
+	cache_entry_t *entry;
+
+	for(entry = buckets[_hash(key)]; entry; entry = entry->next)
+		if(0 == strcmp(entry->key, key))
+			return entry;
+	return NULL;
+}
+
+/* Takes an entry out of the table; it is freed once nobody holds it. Under cache_lock. */
+static void _unhash(cache_entry_t *entry){
+	cache_entry_t **link;
+
+	for(link = &buckets[_hash(entry->key)]; *link != entry; link = &(*link)->next)
+		;
+	*link = entry->next;
+	if(0 == --entry->refs)
+		_entryfree(entry);
+}
+
+/* Evicts a cached entry. Under cache_lock. */
+static void _unlist(cache_entry_t *entry){
+	_useremove(entry);
+	used -= entry->size;
+	_unhash(entry);
+}
+
+/* Fails an entry that is being filled, waking its readers. Under cache_lock. */
+static void _fail(cache_entry_t *entry){
+	if(ENTRY_PENDING != entry->state && ENTRY_FILLING != entry->state)
+		return;
+	entry->state = ENTRY_FAILED;
+	pthread_cond_broadcast(&entry->changed);
+	_unhash(entry);
+}
+
+int cache_init(size_t bytes, const char *policy, const char *dir){
+	if(0 == strcmp(policy, "lru"))
+		lru = 1;
+	else if(0 == strcmp(policy, "fifo"))
+		lru = 0;
+	else
+		return -1;
+
+	capacity = bytes;
+	used = 0;
+	cachedir = dir ? strdup(dir) : NULL;
+	return 0;
+}
+
+cache_entry_t *cache_join(const char *key, int *fetch){
+	cache_entry_t *entry;
+	unsigned int bucket;
+
+	pthread_mutex_lock(&cache_lock);
+	if(NULL != (entry = _find(key))){
+		entry->refs++;
+		if(lru && ENTRY_CACHED == entry->state){
+			_useremove(entry);
+			_usepush(entry);
+		}
+		*fetch = 0;
+	}else{
+		entry = (cache_entry_t*) calloc(1, sizeof(cache_entry_t));
+		entry->key = strdup(key);
+		entry->state = ENTRY_PENDING;
+		entry->fildes = -1;
+		entry->refs = 2;
+		pthread_cond_init(&entry->changed, NULL);
+
+		bucket = _hash(key);
+		entry->next = buckets[bucket];
+		buckets[bucket] = entry;
+		*fetch = 1;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return entry;
+}
+
+int cache_begin(cache_entry_t *entry, size_t size, int has_digest, uint32_t digest){
+	char *path;
+
+	entry->size = size;
+	entry->has_digest = has_digest;
+	entry->digest = digest;
+
+	/* A file too large for the cache is still stored to be shared until it is put */
+	if(cachedir){
+		path = malloc(strlen(cachedir) + sizeof("/gfcache.XXXXXX"));
+		sprintf(path, "%s/gfcache.XXXXXX", cachedir);
+		if(0 <= (entry->fildes = mkstemp(path)))
+			unlink(path);
+		free(path);
+		if(0 > entry->fildes)
+			perror("Unable to create cache file");
+	}else{
+		entry->data = malloc(size > 0 ? size : 1);
+	}
+	if(NULL == entry->data && 0 > entry->fildes){
+		cache_fail(entry);
+		return -1;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	if(ENTRY_PENDING == entry->state){
+		entry->state = ENTRY_FILLING;
+		pthread_cond_broadcast(&entry->changed);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return 0;
+}
+
+int cache_write(cache_entry_t *entry, const void *data, size_t len){
+	/* Only the worker filling the entry changes its state and fill */
+	size_t filled = entry->filled;
+	ssize_t written;
+
+	if(ENTRY_FILLING != entry->state || len > entry->size - filled)
+		return -1;
+
+	if(entry->data){
+		memcpy(entry->data + filled, data, len);
+		filled += len;
+	}
+	while(len > 0 && !entry->data){
+		if( 0 > (written = pwrite(entry->fildes, data, len, filled)))
+			return -1;
+		data = (const char*) data + written;
+		filled += written;
+		len -= written;
+	}
+
+	pthread_mutex_lock(&cache_lock);
+	entry->filled = filled;
+	pthread_cond_broadcast(&entry->changed);
+	pthread_mutex_unlock(&cache_lock);
+	return 0;
+}
+
+void cache_fail(cache_entry_t *entry){
+	pthread_mutex_lock(&cache_lock);
+	_fail(entry);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void cache_answer(cache_entry_t *entry, int status){
+	pthread_mutex_lock(&cache_lock);
+	if(ENTRY_PENDING == entry->state){
+		entry->status = status;
+		_fail(entry);
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void cache_put(cache_entry_t *entry){
+	pthread_mutex_lock(&cache_lock);
+	if(ENTRY_FILLING != entry->state || entry->filled != entry->size){
+		_fail(entry);
+	}else if(entry->size > capacity){
+		entry->state = ENTRY_FILLED;
+		pthread_cond_broadcast(&entry->changed);
+		_unhash(entry);
+	}else{
+		entry->state = ENTRY_CACHED;
+		pthread_cond_broadcast(&entry->changed);
+		_usepush(entry);
+		used += entry->size;
+		while(used > capacity && use_tail != entry)
+			_unlist(use_tail);
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	cache_release(entry);
+}
+
+int cache_wait(cache_entry_t *entry){
+	int state;
+
+	pthread_mutex_lock(&cache_lock);
+	while(ENTRY_PENDING == (state = entry->state))
+		pthread_cond_wait(&entry->changed, &cache_lock);
+	pthread_mutex_unlock(&cache_lock);
+
+	/* An answered entry failed while pending, so its status is set */
+	if(ENTRY_FAILED == state)
+		return entry->status ? entry->status : -1;
+	return 0;
+}
+
+size_t cache_size(cache_entry_t *entry){
+	return entry->size;
+}
+
+int cache_entry_digest(cache_entry_t *entry, size_t *size, uint32_t *digest){
+	if(!entry->has_digest)
+		return -1;
+	*size = entry->size;
+	*digest = entry->digest;
+	return 0;
+}
+
+ssize_t cache_read(cache_entry_t *entry, void *buf, size_t len, off_t offset){
+	size_t filled;
+	int state;
+
+	pthread_mutex_lock(&cache_lock);
+	while(ENTRY_FILLING == (state = entry->state) && (size_t) offset >= entry->filled)
+		pthread_cond_wait(&entry->changed, &cache_lock);
+	filled = entry->filled;
+	pthread_mutex_unlock(&cache_lock);
+
+	if((size_t) offset >= filled)
+		return ENTRY_FAILED == state ? -1 : 0;
+	if(len > filled - offset)
+		len = filled - offset;
+
+	if(entry->data){
+		memcpy(buf, entry->data + offset, len);
+		return len;
+	}
+	return pread(entry->fildes, buf, len, offset);
+}
+
+void cache_release(cache_entry_t *entry){
+	int refs;
+
+	pthread_mutex_lock(&cache_lock);
+	refs = --entry->refs;
+	pthread_mutex_unlock(&cache_lock);
+
+	if(0 == refs)
+		_entryfree(entry);
+}
+
+int cache_digest(const char *key, size_t *size, uint32_t *digest){
+	cache_entry_t *entry;
+	int found = -1;
+
+	pthread_mutex_lock(&cache_lock);
+	if(NULL != (entry = _find(key)) && ENTRY_PENDING != entry->state && entry->has_digest){
+		*size = entry->size;
+		*digest = entry->digest;
+		found = 0;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return found;
+}
+
+void cache_destroy(){
+	pthread_mutex_lock(&cache_lock);
+	while(use_head)
+		_unlist(use_head);
+	pthread_mutex_unlock(&cache_lock);
+
+	free(cachedir);
+	cachedir = NULL;
+}
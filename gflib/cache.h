@@ -0,0 +1,118 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A cached file: its length, the CRC32C its origin announced, if any,
+ * and its bytes.  Readers hold a reference, so an entry that is evicted
+ * while it is being sent stays readable until it is released.
+ *
+ * A file being fetched has an entry in the cache from the first miss on,
+ * so concurrent misses on the same key wait for that one fetch and read
+ * its bytes as they arrive instead of fetching the file again.
+ */
+typedef struct cache_entry_t cache_entry_t;
+
+/*
+ * Initializes an empty cache holding at most capacity bytes of files.
+ * policy is "lru", which evicts the least recently used file first, or
+ * "fifo", which evicts the file cached first.  With dir set, files are
+ * kept in unlinked files created in dir instead of in memory, so the
+ * cache may outgrow memory; they do not outlive the process.
+ * Returns -1 if the policy is unknown.
+ */
+int cache_init(size_t capacity, const char *policy, const char *dir);
+
+/*
+ * Returns the entry for key with a reference held for the caller, which
+ * may still be filling.  If the key is neither cached nor being fetched,
+ * a new entry is registered for it and *fetch is set: the caller fetches
+ * the file, starts the entry with cache_begin, fills it with cache_write
+ * and ends it with cache_put, or cache_fail and then cache_put.
+ */
+cache_entry_t *cache_join(const char *key, int *fetch);
+
+/*
+ * Sets the length and digest of the file of an entry from cache_join and
+ * wakes the callers waiting for them.  A file larger than the cache is
+ * still stored while it is fetched, so its waiters share the fetch, but
+ * cache_put does not cache it.  Returns -1, and fails the entry, if there
+ * is no room to store the file.  The length and digest are kept either way.
+ */
+int cache_begin(cache_entry_t *entry, size_t size, int has_digest, uint32_t digest);
+
+/*
+ * Appends len bytes to an entry being filled and wakes its readers.
+ * Returns -1 if they do not fit in its size or cannot be stored.
+ */
+int cache_write(cache_entry_t *entry, const void *data, size_t len);
+
+/*
+ * Gives up on filling an entry: it leaves the cache, so the next miss on
+ * its key fetches the file again, and its readers get an error once they
+ * have read what was filled.
+ */
+void cache_fail(cache_entry_t *entry);
+
+/*
+ * Ends an entry from cache_join whose origin answered without a file,
+ * with a positive status such as not found.  The entry leaves the cache
+ * like a failed one, and cache_wait returns status to its waiters, so
+ * they answer the same without asking the origin again.
+ */
+void cache_answer(cache_entry_t *entry, int status);
+
+/*
+ * Adds an entry filled to its size to the cache and evicts files by the
+ * policy until the cache fits.  An entry that is not filled, or failed,
+ * is dropped instead, and so is one larger than the cache, which its
+ * readers can still read whole.  Either way the caller's reference is released.
+ */
+void cache_put(cache_entry_t *entry);
+
+/*
+ * Waits until the length of the file of an entry is known, and returns 0,
+ * or the status given to cache_answer.  Returns -1 if the entry failed
+ * first for another reason.
+ */
+int cache_wait(cache_entry_t *entry);
+
+/*
+ * Returns the length of the file of an entry.
+ */
+size_t cache_size(cache_entry_t *entry);
+
+/*
+ * Sets size and digest to the length and CRC32C of the file of an entry.
+ * Returns -1 if its origin announced no digest.
+ */
+int cache_entry_digest(cache_entry_t *entry, size_t *size, uint32_t *digest);
+
+/*
+ * Reads up to len bytes of the file of an entry at offset, like pread(2),
+ * waiting for them while the entry fills.  Returns 0 at the end of the
+ * file and -1 at the end of what a failed entry was filled with.
+ */
+ssize_t cache_read(cache_entry_t *entry, void *buf, size_t len, off_t offset);
+
+/*
+ * Drops a reference from cache_join.
+ */
+void cache_release(cache_entry_t *entry);
+
+/*
+ * Sets size and digest to the length and CRC32C of the cached file for
+ * key.  Returns -1 if the key is not cached or came without a digest.
+ */
+int cache_digest(const char *key, size_t *size, uint32_t *digest);
+
+/*
+ * Empties the cache.  Entries still referenced are freed by their
+ * last cache_release.
+ */
+void cache_destroy();
+
+#endif
@@ -4,21 +4,173 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "content.h"
+#include "crc32c.h"
 
 #define MAX_KEYLEN 256
+#define DIGEST_BUFSIZE (256 * 1024)
+#define DIGEST_MAX_THREADS 8
+#define GZIP_WINDOW (15 + 16)	/* zlib window bits for a gzip wrapper */
+#define GZIP_SUFFIX ".gz"
+
+#define GZ_NONE -1	/* no variant yet */
+#define GZ_PENDING -2	/* queued for the compressor */
+#define GZ_SKIP -3	/* does not compress well enough to keep, or changed since digested */
 
 typedef struct{
 	int fildes;
-	char key[MAX_KEYLEN];
+	int digested;	/* digest and size are valid */
+	uint32_t digest;
+	size_t size;
+	off_t stsize;	/* size and modification time of the file when it was digested */
+	struct timespec mtime;
+	int gzfildes;	/* gzip variant, or one of GZ_NONE, GZ_PENDING, GZ_SKIP; atomic */
+	size_t gzsize;	/* set before gzfildes is published */
+	char key[MAX_KEYLEN];	/* "key\0path\0", split by content_init */
 } item_t;
 
 static int nitems;
 static item_t *items;
+static int next_digest;	/* next item a digest thread claims */
+
+/* Background compressor; every item is queued at most once, so nitems slots suffice */
+static pthread_t gz_thread;
+static pthread_mutex_t gz_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gz_cond = PTHREAD_COND_INITIALIZER;
+static item_t **gz_queue;
+static int gz_head, gz_tail;
+static int gz_running, gz_stop;
+
+static const char *_itempath(item_t *item){
+	return item->key + strlen(item->key) + 1;
+}
 
 static int _itemcmp(const void *a, const void *b){
 	return strcmp(((item_t*) a)->key,((item_t*) b)->key);
 }
 
+/* Checksums one file through pread so the shared descriptor offset is untouched */
+static void _itemdigest(item_t *item, char *buffer){
+	uint32_t crc = 0;
+	size_t size = 0;
+	ssize_t got;
+	struct stat st;
+
+	/* Taken first, so a change made while the file is read shows up later */
+	if(0 > fstat(item->fildes, &st)){
+		fprintf(stderr, "Unable to checksum %s.\n", item->key);
+		return;
+	}
+	while( 0 < (got = pread(item->fildes, buffer, DIGEST_BUFSIZE, size))){
+		crc = crc32c(crc, buffer, got);
+		size += got;
+	}
+	if(got < 0){
+		fprintf(stderr, "Unable to checksum %s.\n", item->key);
+		return;
+	}
+
+	item->digest = crc;
+	item->size = size;
+	item->stsize = st.st_size;
+	item->mtime = st.st_mtim;
+	item->digested = 1;
+}
+
+/* Returns 1 if the file of a digested item has not changed since it was digested */
+static int _itemcurrent(item_t *item){
+	struct stat st;
+
+	return item->digested && 0 == fstat(item->fildes, &st) && st.st_size == item->stsize &&
+		st.st_mtim.tv_sec == item->mtime.tv_sec && st.st_mtim.tv_nsec == item->mtime.tv_nsec;
+}
+
+/*
+ * Adopts "<path>.gz" as the item's gzip variant if it inflates to exactly
+ * the digested file, so a stale or foreign sibling is never served. The
+ * buffer is split between compressed input and inflated output.
+ */
+static void _itemsibling(item_t *item, char *buffer){
+	char path[MAX_KEYLEN + sizeof(GZIP_SUFFIX)];
+	unsigned char *out = (unsigned char*) buffer + DIGEST_BUFSIZE / 2;
+	z_stream z;
+	uint32_t crc = 0;
+	size_t size = 0, offset = 0;
+	ssize_t got;
+	int fildes, status = Z_OK;
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s" GZIP_SUFFIX, _itempath(item));
+	if(!item->digested || 0 > (fildes = open(path, O_RDONLY)))
+		return;
+
+	memset(&z, 0, sizeof(z));
+	if(Z_OK != inflateInit2(&z, GZIP_WINDOW)){
+		close(fildes);
+		return;
+	}
+	while(Z_OK == status && 0 < (got = pread(fildes, buffer, DIGEST_BUFSIZE / 2, offset))){
+		offset += got;
+		z.next_in = (unsigned char*) buffer;
+		z.avail_in = got;
+		do{
+			z.next_out = out;
+			z.avail_out = DIGEST_BUFSIZE / 2;
+			status = inflate(&z, Z_NO_FLUSH);
+			if(Z_BUF_ERROR == status && 0 == z.avail_in)
+				status = Z_OK;	/* output was exactly full: nothing more yet */
+			crc = crc32c(crc, out, DIGEST_BUFSIZE / 2 - z.avail_out);
+			size += DIGEST_BUFSIZE / 2 - z.avail_out;
+		}while(Z_OK == status && (0 < z.avail_in || 0 == z.avail_out));
+	}
+	inflateEnd(&z);
+
+	if(Z_STREAM_END != status || size != item->size || crc != item->digest || 0 > fstat(fildes, &st)){
+		fprintf(stderr, "Ignoring %s, which does not match %s.\n", path, _itempath(item));
+		close(fildes);
+		return;
+	}
+	item->gzsize = st.st_size;
+	item->gzfildes = fildes;
+}
+
+static void *_digestloop(void *arg){
+	char *buffer = malloc(DIGEST_BUFSIZE);
+	int i;
+
+	(void) arg;
+	while( (i = __atomic_fetch_add(&next_digest, 1, __ATOMIC_RELAXED)) < nitems){
+		_itemdigest(&items[i], buffer);
+		_itemsibling(&items[i], buffer);
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+/* Checksums every item, spreading the files over one thread per CPU */
+static void _digestall(){
+	pthread_t threads[DIGEST_MAX_THREADS];
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, started = 0;
+
+	if(nthreads > DIGEST_MAX_THREADS)
+		nthreads = DIGEST_MAX_THREADS;
+	if(nthreads > nitems)
+		nthreads = nitems;
+
+	next_digest = 0;
+	for(i = 1; i < nthreads; i++)
+		if(0 == pthread_create(&threads[started], NULL, _digestloop, NULL))
+			started++;
+	_digestloop(NULL);
+	for(i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
+
 int content_init(const char *filename){
 	FILE *filelist;
 	int capacity = 16;
@@ -44,6 +196,8 @@ int content_init(const char *filename){
 			fprintf(stderr, "Unable to open file %s.\n", path);
 			exit(EXIT_FAILURE);
 		}
+		items[nitems].digested = 0;
+		items[nitems].gzfildes = GZ_NONE;
 		nitems++;
 
 		if(nitems == capacity){
@@ -57,36 +211,205 @@ int content_init(const char *filename){
 
 	qsort(items, nitems, sizeof(item_t), _itemcmp);
 
+	_digestall();
+
 	return EXIT_SUCCESS;
 }
 
-int content_get(const char *key){
+static item_t *_itemfind(const char *key){
 	int lo = 0;
 	int hi = nitems - 1;
 	int mid, cmp;
 
-#if defined(DELAY)
-	usleep(DELAY); // simulate slow I/O subsystem
-#endif // DELAY
-
 	while (lo <= hi) {
 		// Key is in items[lo..hi] or not present.
 		mid = lo + (hi - lo) / 2;
 		cmp = strcmp(key,items[mid].key);
 		if ( cmp < 0) hi = mid - 1;
 		else if (cmp > 0) lo = mid + 1;
-		else{
-			lseek(items[mid].fildes, 0, SEEK_SET);
-			return items[mid].fildes;
-		} 
+		else return &items[mid];
+	}
+	return NULL;
+}
+
+int content_get(const char *key){
+	item_t *item;
+
+#if defined(DELAY)
+	usleep(DELAY); // simulate slow I/O subsystem
+#endif // DELAY
+
+	if( NULL == (item = _itemfind(key)))
+		return -1;
+
+	lseek(item->fildes, 0, SEEK_SET);
+	return item->fildes;
+}
+
+int content_digest(const char *key, size_t *size, uint32_t *digest){
+	item_t *item;
+
+	if( NULL == (item = _itemfind(key)) || !_itemcurrent(item))
+		return -1;
+
+	*size = item->size;
+	*digest = item->digest;
+	return 0;
+}
+
+/* Writes all of len bytes, returning -1 on error */
+static int _writeall(int fildes, const unsigned char *data, size_t len){
+	ssize_t written;
+
+	while(len > 0){
+		if( 0 > (written = write(fildes, data, len)))
+			return -1;
+		data += written;
+		len -= written;
+	}
+	return 0;
+}
+
+/*
+ * Compresses the digested bytes of an item into an unlinked temporary
+ * file and publishes it as the item's gzip variant, unless the file
+ * changed since it was digested or the variant would save less than a
+ * tenth of it.
+ */
+static void _itemcompress(item_t *item, char *buffer){
+	unsigned char *out = (unsigned char*) buffer + DIGEST_BUFSIZE / 2;
+	z_stream z;
+	uint32_t crc = 0;
+	size_t offset = 0, gzsize = 0;
+	ssize_t got = 0;
+	int fildes = -1, status = Z_OK, flush;
+	FILE *tmp;
+
+	memset(&z, 0, sizeof(z));
+	if(NULL != (tmp = tmpfile())){
+		fildes = dup(fileno(tmp));
+		fclose(tmp);
+	}
+	if(0 > fildes || Z_OK != deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW, 8, Z_DEFAULT_STRATEGY)){
+		if(0 <= fildes)
+			close(fildes);
+		__atomic_store_n(&item->gzfildes, GZ_SKIP, __ATOMIC_RELEASE);
+		return;
+	}
+
+	do{
+		got = pread(item->fildes, buffer, DIGEST_BUFSIZE / 2 < item->size - offset ? DIGEST_BUFSIZE / 2 : item->size - offset, offset);
+		if(got < 0)
+			break;
+		crc = crc32c(crc, buffer, got);
+		offset += got;
+		flush = (0 == got || offset == item->size) ? Z_FINISH : Z_NO_FLUSH;
+		z.next_in = (unsigned char*) buffer;
+		z.avail_in = got;
+		do{
+			z.next_out = out;
+			z.avail_out = DIGEST_BUFSIZE / 2;
+			status = deflate(&z, flush);
+			if(0 > _writeall(fildes, out, DIGEST_BUFSIZE / 2 - z.avail_out))
+				status = Z_ERRNO;
+			gzsize += DIGEST_BUFSIZE / 2 - z.avail_out;
+		}while(Z_OK == status && 0 == z.avail_out);
+	}while(Z_OK == status && Z_NO_FLUSH == flush);
+	deflateEnd(&z);
+
+	if(Z_STREAM_END != status || offset != item->size || crc != item->digest || gzsize >= item->size - item->size / 10){
+		close(fildes);
+		__atomic_store_n(&item->gzfildes, GZ_SKIP, __ATOMIC_RELEASE);
+		return;
+	}
+	item->gzsize = gzsize;
+	__atomic_store_n(&item->gzfildes, fildes, __ATOMIC_RELEASE);
+}
+
+static void *_gzloop(void *arg){
+	char *buffer = malloc(DIGEST_BUFSIZE);
+	item_t *item;
+
+	(void) arg;
+	for(;;){
+		pthread_mutex_lock(&gz_lock);
+		while(!gz_stop && gz_head == gz_tail)
+			pthread_cond_wait(&gz_cond, &gz_lock);
+		if(gz_stop){
+			pthread_mutex_unlock(&gz_lock);
+			break;
+		}
+		item = gz_queue[gz_head++];
+		pthread_mutex_unlock(&gz_lock);
+
+		_itemcompress(item, buffer);
+	}
+
+	free(buffer);
+	return NULL;
+}
+
+int content_gzip_start(){
+	gz_queue = (item_t**) malloc((nitems > 0 ? nitems : 1) * sizeof(item_t*));
+	gz_head = gz_tail = 0;
+	gz_stop = 0;
+	if(0 != pthread_create(&gz_thread, NULL, _gzloop, NULL)){
+		free(gz_queue);
+		gz_queue = NULL;
+		return -1;
+	}
+	gz_running = 1;
+	return 0;
+}
+
+int content_encoded(const char *key, const char *encoding, size_t *size){
+	item_t *item;
+	int fildes, expected = GZ_NONE;
+
+	if(0 != strcmp(encoding, "gzip") || NULL == (item = _itemfind(key)) || !item->digested)
+		return -1;
+
+	/* A variant of a file changed since it was digested is stale: drop it for good */
+	if(!_itemcurrent(item)){
+		if(0 <= (fildes = __atomic_exchange_n(&item->gzfildes, GZ_SKIP, __ATOMIC_ACQ_REL)))
+			close(fildes);
+		return -1;
+	}
+
+	if(0 <= (fildes = __atomic_load_n(&item->gzfildes, __ATOMIC_ACQUIRE))){
+		*size = item->gzsize;
+		return fildes;
+	}
+
+	/* The first request for a file without a variant queues one for later requests */
+	if(gz_running && GZ_NONE == fildes &&
+			__atomic_compare_exchange_n(&item->gzfildes, &expected, GZ_PENDING, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+		pthread_mutex_lock(&gz_lock);
+		gz_queue[gz_tail++] = item;
+		pthread_mutex_unlock(&gz_lock);
+		pthread_cond_signal(&gz_cond);
 	}
 	return -1;
 }
 
 void content_destroy(){
 	int i;
-	for(i = 0; i < nitems; i++)
+
+	if(gz_running){
+		pthread_mutex_lock(&gz_lock);
+		gz_stop = 1;
+		pthread_mutex_unlock(&gz_lock);
+		pthread_cond_signal(&gz_cond);
+		pthread_join(gz_thread, NULL);
+		gz_running = 0;
+		free(gz_queue);
+	}
+
+	for(i = 0; i < nitems; i++){
 		close(items[i].fildes);
+		if(0 <= items[i].gzfildes)
+			close(items[i].gzfildes);
+	}
 	
 	free(items);
 }
@@ -1,6 +1,9 @@
 #ifndef __CONTENT_H__
 #define __CONTENT_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 /* 
  * Initializes the content library given the information from
  * the provided file.  Each row of the file is assumed
@@ -9,7 +12,8 @@
  *
  * Subsequent calls to content_get with a key value
  * as an argument will return the file descriptor for the 
- * given file path.
+ * given file path.  Every file is also checksummed once
+ * here, in parallel, for content_digest.
  */
 int content_init(const char *filename);
 
@@ -19,6 +23,34 @@ int content_init(const char *filename);
  */
 int content_get(const char *key);
 
+/*
+ * Sets size and digest to the length and CRC32C of the file
+ * associated with key, as read by content_init.  Returns -1 if
+ * the key is not found, its file could not be read, or its size
+ * or modification time changed since, so the digest is stale.
+ */
+int content_digest(const char *key, size_t *size, uint32_t *digest);
+
+/*
+ * Returns a descriptor for the gzip variant of the file associated with
+ * key and sets size to its length, or returns -1 if the encoding is not
+ * "gzip" or there is no variant yet.  Variants are "<path>.gz" files
+ * found by content_init that inflate to exactly the file, and, once
+ * content_gzip_start has run, compressed copies built in the background
+ * after a file is first asked for.  The descriptor is shared: read it
+ * at explicit offsets.  The variant of a file whose size or modification
+ * time changed since content_init is closed, and the file is then only
+ * served as is.
+ */
+int content_encoded(const char *key, const char *encoding, size_t *size);
+
+/*
+ * Starts the background thread that builds missing gzip variants for
+ * content_encoded.  Files that compress by less than a tenth are not
+ * kept.  Returns -1 if the thread cannot be started.
+ */
+int content_gzip_start();
+
 /* 
  * Frees all memory and closes all file descriptors
  * associated with the cache.
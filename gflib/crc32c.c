@@ -0,0 +1,89 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78	/* reflected Castagnoli polynomial */
+
+/* Slicing-by-8 tables for the software path, built once on first use */
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void _tableinit(){
+	uint32_t crc;
+	int i, j;
+
+	for(i = 0; i < 256; i++){
+		crc = i;
+		for(j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+		table[0][i] = crc;
+	}
+	for(i = 0; i < 256; i++)
+		for(j = 1; j < 8; j++)
+			table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+}
+
+static uint32_t _crcsw(uint32_t crc, const unsigned char *p, size_t len){
+	uint64_t word;
+
+	pthread_once(&table_once, _tableinit);
+
+	for(; len > 0 && ((uintptr_t) p & 7); len--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+	for(; len >= 8; len -= 8, p += 8){
+		memcpy(&word, p, 8);
+		word ^= crc;	/* little-endian: the low byte is the first one */
+		crc = table[7][word & 0xff] ^
+			table[6][(word >> 8) & 0xff] ^
+			table[5][(word >> 16) & 0xff] ^
+			table[4][(word >> 24) & 0xff] ^
+			table[3][(word >> 32) & 0xff] ^
+			table[2][(word >> 40) & 0xff] ^
+			table[1][(word >> 48) & 0xff] ^
+			table[0][word >> 56];
+	}
+	for(; len > 0; len--)
+		crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+
+	return crc;
+}
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t _crchw(uint32_t crc, const unsigned char *p, size_t len){
+	uint64_t crc64, word;
+
+	for(; len > 0 && ((uintptr_t) p & 7); len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	crc64 = crc;
+	for(; len >= 8; len -= 8, p += 8){
+		memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t) crc64;
+	for(; len > 0; len--)
+		crc = _mm_crc32_u8(crc, *p++);
+
+	return crc;
+}
+
+static int _hashw(){
+	static int has = -1;
+
+	if(has < 0)
+		has = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+	return has;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len){
+	crc = ~crc;
+#if defined(__x86_64__)
+	if(_hashw())
+		return ~_crchw(crc, data, len);
+#endif
+	return ~_crcsw(crc, data, len);
+}
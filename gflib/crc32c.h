@@ -0,0 +1,15 @@
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC32C (Castagnoli) of len bytes at data, continuing from crc.  Start
+ * with 0 and feed the result of each call into the next to checksum data
+ * that arrives in pieces.  Uses the SSE4.2 crc32 instruction when the CPU
+ * has it and a table-driven loop otherwise; both give the same value.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+#endif
@@ -22,4 +22,37 @@
 #include <sys/signal.h>
 #include <netinet/in.h>
 
+/*
+ * Version tag of a file, built from its length and CRC32C as
+ * "<length>-<8 hex digits>".  A client that sends the tag of its copy
+ * as "GETFILE GET <path> IF-NONE-MATCH <tag>" gets NOT_MODIFIED and no
+ * body while the server's file still has that tag.
+ */
+#define GF_TAG_FORMAT "%zu-%08x"
+#define GF_TAG_MAX 32
+#define GF_IF_NONE_MATCH " IF-NONE-MATCH "
+
+/*
+ * Batch request: "GETFILE MGET\r\n" followed by one "<path>\r\n" line
+ * per file and an empty line.  The response is "GETFILE MGET <count>\r\n\r\n"
+ * followed by one record per path, in request order: a
+ * "<status> <length>[ crc32c=<8 hex digits>]\r\n" line and length bytes of
+ * body (none unless the status is OK).
+ */
+#define GF_MGET_REQUEST "GETFILE MGET\r\n"
+#define GF_MGET_MAX_PATHS 4096
+#define GF_MGET_MAX_REQUEST (GF_MGET_MAX_PATHS * 258 + 32)
+
+/*
+ * Content encoding: a GET that ends with " ACCEPT-ENCODING <token>[,<token>...]"
+ * may be answered with an encoded body, announced as
+ * "GETFILE OK <encoded length> crc32c=<8 hex digits> encoding=<token> length=<length>".
+ * The body is the encoded length in bytes; the digest, the length and the
+ * version tag are those of the decoded file.  Only gzip is defined.
+ */
+#define GF_ACCEPT_ENCODING " ACCEPT-ENCODING "
+#define GF_ENCODING_FIELD " encoding="
+#define GF_LENGTH_FIELD " length="
+#define GF_ENCODING_GZIP "gzip"
+
  #endif // __GF_STUDENT_H__
@@ -1,7 +1,12 @@
 
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <fcntl.h>
+#include <zlib.h>
 
 #include "gfclient-student.h"
+#include "crc32c.h"
+#include "log.h"
 
  // Modify this file to implement the interface specified in
  // gfclient.h.
@@ -9,6 +14,11 @@
 // define buffsize
 #define BUFSIZE 512
 #define PATH_BUFFER_SIZE 512
+#define SINK_BUFSIZE (256 * 1024) // receive buffer when the body goes to a sink fd
+#define SINK_ALIGN 4096
+#define MGET_BUFSIZE (64 * 1024) // receive buffer for batch responses
+#define INFLATE_BUFSIZE (64 * 1024) // output buffer for decoding an encoded body
+#define GZIP_WINDOW (15 + 16) // zlib window bits for a gzip wrapper
 
 // optional function for cleaup processing.
 void gfc_cleanup(gfcrequest_t **gfr) {
@@ -23,6 +33,10 @@ struct gfcrequest_t {
   const char *server;  // server to connect
   unsigned short port; // file transfer port
   const char *path; // request path
+  const char *ifnonematch; // version tag for a conditional request, NULL if unset
+  const char *acceptencoding; // encodings offered to the server, NULL if unset
+  const char **paths; // paths of a batch request
+  size_t npaths; // number of paths in a batch, 0 for a single path
   char *request; // request sent to the server
   char *response; // response received from the server
   size_t bytes_received; // number of bytes received from the server
@@ -34,6 +48,22 @@ struct gfcrequest_t {
   void *headerarg; // header arguments
   void (*writefunc)(void *, size_t, void *); // write function
   void *writearg; // write arguments
+  void (*memberfunc)(size_t, gfstatus_t, size_t, void *); // start of each file of a batch
+  void *memberarg; // member arguments
+  int sink_fd; // body destination instead of writefunc, -1 if unset
+
+  // Integrity
+  bool has_digest; // the OK header announced a CRC32C of the body
+  uint32_t digest; // CRC32C announced by the server
+  uint32_t crc; // rolling CRC32C of the body received so far
+  char tag[GF_TAG_MAX]; // version tag of the body, valid with has_digest
+
+  // Encoding
+  bool encoded; // the body is gzip and is inflated on its way to the caller
+  z_stream inflater; // state of the inflation, valid with encoded
+  int inflate_status; // last inflate result, Z_STREAM_END once the body is whole
+  size_t decoded_length; // length of the decoded file, from the header
+  size_t decoded; // decoded bytes handed to the caller
 };
 
 gfcrequest_t *gfc_create() {
@@ -56,6 +86,7 @@ gfcrequest_t *gfc_create() {
   gfr->headerarg = NULL;
   gfr->writefunc = NULL;
   gfr->writearg = NULL;
+  gfr->sink_fd = -1;
 
   return gfr;
 }
@@ -78,23 +109,27 @@ void gfc_global_cleanup() {}
 
 // Additional helper functions 
 
-/* Validates the status of the request. */
-int validate_status(gfcrequest_t **gfr, const char *header_status) {
+/* Maps a status word of a response to its status. */
+static gfstatus_t parse_status(const char *header_status) {
   if (strcmp(header_status, "OK") == 0) {
-    (*gfr)->status = GF_OK;
-    return 1;
+    return GF_OK;
   } else if (strcmp(header_status, "FILE_NOT_FOUND") == 0) {
-    (*gfr)->status = GF_FILE_NOT_FOUND;
-    return -1;
+    return GF_FILE_NOT_FOUND;
+  } else if (strcmp(header_status, "NOT_MODIFIED") == 0) {
+    return GF_NOT_MODIFIED;
   } else if (strcmp(header_status, "INVALID") == 0) {
-    (*gfr)->status = GF_INVALID;
-    return -1;
+    return GF_INVALID;
   } else {
-    (*gfr)->status = GF_ERROR;
-    return -1;
+    return GF_ERROR;
   }
 }
 
+/* Validates the status of the request. */
+int validate_status(gfcrequest_t **gfr, const char *header_status) {
+  (*gfr)->status = parse_status(header_status);
+  return (*gfr)->status == GF_OK ? 1 : -1;
+}
+
 /* Parses the empty header as requested. */
 int empty_header_parser(gfcrequest_t **gfr, const char *buffer, int current_bytes_received, size_t expected_len, int sscanf_result, bool header_received) {
   // check if no data is transferred
@@ -139,6 +174,292 @@ int header_parser(gfcrequest_t **gfr, size_t current_bytes_received, size_t expe
   return -1;
 }
 
+/* Writes all of data to fd, returning -1 on error. */
+static int write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t written = write(fd, data, len);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += written;
+    len -= written;
+  }
+  return 0;
+}
+
+/* Hands a chunk of the decoded body to the sink fd or the write callback, folding it into the rolling digest. */
+static void emit(gfcrequest_t **gfr, char *data, size_t len) {
+  if (len == 0)
+    return;
+  (*gfr)->decoded += len;
+  if ((*gfr)->has_digest)
+    (*gfr)->crc = crc32c((*gfr)->crc, data, len);
+  if ((*gfr)->sink_fd >= 0) {
+    if (write_all((*gfr)->sink_fd, data, len) < 0)
+      perror("write to sink failed");
+  } else if ((*gfr)->writefunc) {
+    (*gfr)->writefunc(data, len, (*gfr)->writearg);
+  }
+}
+
+/* Hands a chunk of the body as received to emit, inflating it first when it is encoded. */
+static void deliver(gfcrequest_t **gfr, char *data, size_t len) {
+  char out[INFLATE_BUFSIZE];
+  z_stream *z = &(*gfr)->inflater;
+
+  if (!(*gfr)->encoded) {
+    emit(gfr, data, len);
+    return;
+  }
+
+  // a stream that ended or failed takes no more input, so it stays short
+  z->next_in = (Bytef *)data;
+  z->avail_in = len;
+  while ((*gfr)->inflate_status == Z_OK && (z->avail_in > 0 || z->avail_out == 0)) {
+    z->next_out = (Bytef *)out;
+    z->avail_out = sizeof(out);
+    (*gfr)->inflate_status = inflate(z, Z_NO_FLUSH);
+    if ((*gfr)->inflate_status == Z_BUF_ERROR && z->avail_in == 0)
+      (*gfr)->inflate_status = Z_OK; // the last output filled the buffer exactly
+    emit(gfr, out, sizeof(out) - z->avail_out);
+  }
+}
+
+#if defined(__linux__)
+/*
+ * Moves len bytes from the pipe to the sink. A sink that refuses splice
+ * (e.g. one opened with O_APPEND) gets them copied through a small buffer
+ * instead, and -1 tells the caller to stop splicing.
+ */
+static int drain_pipe(gfcrequest_t **gfr, int pipe_out, size_t len) {
+  int result = 0;
+
+  while (len > 0) {
+    ssize_t out = splice(pipe_out, NULL, (*gfr)->sink_fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (out < 0 && errno == EINTR)
+      continue;
+    if (out <= 0) {
+      char buf[BUFSIZE];
+      ssize_t got = read(pipe_out, buf, len < sizeof(buf) ? len : sizeof(buf));
+      if (got <= 0)
+        return -1;
+      deliver(gfr, buf, got);
+      out = got;
+      result = -1;
+    }
+    len -= out;
+  }
+  return result;
+}
+
+/*
+ * Moves the rest of the body from the socket to the sink through a pipe,
+ * so the data never enters user space. Returns -1 if the caller has to
+ * receive whatever is left with receive_body.
+ */
+static int splice_body(gfcrequest_t **gfr, size_t remaining) {
+  int pipefd[2];
+  int result = 0;
+
+  if (pipe2(pipefd, O_CLOEXEC) < 0)
+    return -1;
+
+  while (remaining > 0) {
+    size_t want = remaining < SINK_BUFSIZE ? remaining : SINK_BUFSIZE;
+    ssize_t in = splice((*gfr)->socket_fd, NULL, pipefd[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in < 0 && errno == EINTR)
+      continue;
+    if (in < 0) {
+      // e.g. EINVAL for a socket and sink splice cannot join; nothing was
+      // moved, so the buffered path receives the rest
+      result = -1;
+      break;
+    }
+    if (in == 0)
+      break; // connection closed early, the caller sees the short count
+
+    (*gfr)->bytes_received += in;
+    remaining -= in;
+    if (drain_pipe(gfr, pipefd[0], in) < 0) {
+      result = -1;
+      break;
+    }
+  }
+
+  close(pipefd[0]);
+  close(pipefd[1]);
+  return result;
+}
+#endif
+
+/* Receives the rest of the body in large aligned buffers and writes them to the sink. */
+static void receive_body(gfcrequest_t **gfr, size_t remaining) {
+  char *buffer;
+
+  if (posix_memalign((void **)&buffer, SINK_ALIGN, SINK_BUFSIZE) != 0)
+    return;
+
+  while (remaining > 0) {
+    size_t want = remaining < SINK_BUFSIZE ? remaining : SINK_BUFSIZE;
+    ssize_t got = recv((*gfr)->socket_fd, buffer, want, 0);
+    if (got <= 0) {
+      if (got < 0 && errno == EINTR)
+        continue;
+      break; // connection closed early, the caller sees the short count
+    }
+    deliver(gfr, buffer, got);
+    (*gfr)->bytes_received += got;
+    remaining -= got;
+  }
+
+  free(buffer);
+}
+
+/* Receive buffer for batch responses, which are read as lines and bodies. */
+typedef struct {
+  char *data;
+  size_t start; // first byte not consumed yet
+  size_t end; // one past the last byte received
+} mget_buffer_t;
+
+/* Receives more of the response after whatever is left unconsumed. */
+static ssize_t mget_fill(gfcrequest_t **gfr, mget_buffer_t *in) {
+  ssize_t got;
+
+  if (in->start > 0) {
+    memmove(in->data, in->data + in->start, in->end - in->start);
+    in->end -= in->start;
+    in->start = 0;
+  }
+  do {
+    got = recv((*gfr)->socket_fd, in->data + in->end, MGET_BUFSIZE - in->end, 0);
+  } while (got < 0 && errno == EINTR);
+  if (got > 0)
+    in->end += got;
+  return got;
+}
+
+/*
+ * Consumes the next line up to terminator and returns it NUL-terminated,
+ * or NULL if the connection ends first. The line is only valid until the
+ * next call on the buffer.
+ */
+static char *mget_line(gfcrequest_t **gfr, mget_buffer_t *in, const char *terminator, size_t len) {
+  char *found, *line;
+
+  while (!(found = memmem(in->data + in->start, in->end - in->start, terminator, len))) {
+    if (in->end - in->start == MGET_BUFSIZE || mget_fill(gfr, in) <= 0)
+      return NULL;
+  }
+  line = in->data + in->start;
+  *found = '\0';
+  in->start = found + len - in->data;
+  return line;
+}
+
+/* Delivers the next remaining bytes of the response as one file's body. */
+static int mget_body(gfcrequest_t **gfr, mget_buffer_t *in, size_t remaining) {
+  while (remaining > 0) {
+    if (in->start == in->end) {
+      in->start = in->end = 0;
+      if (mget_fill(gfr, in) <= 0)
+        return -1;
+    }
+    size_t chunk = in->end - in->start < remaining ? in->end - in->start : remaining;
+    deliver(gfr, in->data + in->start, chunk);
+    (*gfr)->bytes_received += chunk;
+    in->start += chunk;
+    remaining -= chunk;
+  }
+  return 0;
+}
+
+/*
+ * Sends a batch request for every path and hands each record of the
+ * response to the member callback and its body to the write callback.
+ * Every body is checked against its digest when it carries one; a body
+ * that fails the check or is cut short is reported again with GF_ERROR.
+ */
+static int perform_mget(gfcrequest_t **gfr) {
+  mget_buffer_t in = { NULL, 0, 0 };
+  char header_status[16];
+  char *request, *line;
+  size_t request_len = sizeof(GF_MGET_REQUEST) - 1 + 2;
+  size_t i, count, file_len;
+  unsigned int digest = 0;
+  gfstatus_t status;
+  int result = 0;
+  bool cut_short;
+
+  // GETFILE MGET\r\n<path>\r\n...\r\n\r\n
+  for (i = 0; i < (*gfr)->npaths; i++) {
+    request_len += strlen((*gfr)->paths[i]) + 2;
+  }
+  request = malloc(request_len + 1);
+  line = stpcpy(request, GF_MGET_REQUEST);
+  for (i = 0; i < (*gfr)->npaths; i++) {
+    line = stpcpy(stpcpy(line, (*gfr)->paths[i]), "\r\n");
+  }
+  stpcpy(line, "\r\n");
+  result = write_all((*gfr)->socket_fd, request, request_len);
+  free(request);
+
+  in.data = malloc(MGET_BUFSIZE);
+  line = result < 0 ? NULL : mget_line(gfr, &in, "\r\n\r\n", 4);
+  if (!line) {
+    (*gfr)->status = GF_INVALID;
+    result = -1;
+  } else if (sscanf(line, "GETFILE MGET %zu", &count) == 1 && count == (*gfr)->npaths) {
+    (*gfr)->status = GF_OK;
+  } else if (sscanf(line, "GETFILE %15s", header_status) == 1 && parse_status(header_status) != GF_OK) {
+    // the whole batch was refused, e.g. by a server without batch support
+    (*gfr)->status = parse_status(header_status);
+    count = 0;
+  } else {
+    (*gfr)->status = GF_INVALID;
+    result = -1;
+  }
+
+  // a body that fails its checksum still leaves the stream in step, so only
+  // a record cut short ends the batch early
+  for (i = 0; i < count; i++) {
+    if (!(line = mget_line(gfr, &in, "\r\n", 2)) ||
+        sscanf(line, "%15s %zu", header_status, &file_len) != 2) {
+      result = -1;
+      break;
+    }
+    status = parse_status(header_status);
+    (*gfr)->has_digest = sscanf(line, "%*s %*u crc32c=%8x", &digest) == 1;
+    (*gfr)->digest = digest;
+    (*gfr)->crc = 0;
+    (*gfr)->file_length += file_len;
+
+    if ((*gfr)->memberfunc) {
+      (*gfr)->memberfunc(i, status, file_len, (*gfr)->memberarg);
+    }
+    cut_short = mget_body(gfr, &in, file_len) < 0;
+    if (cut_short || ((*gfr)->has_digest && (*gfr)->crc != (*gfr)->digest)) {
+      if (!cut_short) {
+        L(ERROR, "checksum mismatch for %s: expected crc32c %08x, received %08x", (*gfr)->paths[i], (*gfr)->digest, (*gfr)->crc);
+      }
+      if ((*gfr)->memberfunc) {
+        (*gfr)->memberfunc(i, GF_ERROR, file_len, (*gfr)->memberarg);
+      }
+      result = -1;
+    }
+    if (cut_short) {
+      break;
+    }
+  }
+  (*gfr)->has_digest = false;
+
+  free(in.data);
+  close((*gfr)->socket_fd);
+  return result;
+}
+
 int gfc_perform(gfcrequest_t **gfr) {
   // Based on Beej's Guide ch.5 implementation 
   // Steps: 
@@ -201,9 +522,30 @@ int gfc_perform(gfcrequest_t **gfr) {
   // Clear the res memory
   freeaddrinfo(res);
 
-  // Build the getfile request
+  // No address took the connection: fail this request rather than the caller
+  if (p == NULL) {
+    close((*gfr)->socket_fd);
+    (*gfr)->status = GF_ERROR;
+    return -1;
+  }
+
+  if ((*gfr)->npaths > 0) {
+    return perform_mget(gfr);
+  }
+
+  // Build the getfile request, conditional when the caller has a version tag
+  // and offering the encodings the caller accepts
   (*gfr)->request = (char *) malloc(BUFSIZE);
-  sprintf((*gfr)->request, "GETFILE GET %s\r\n\r\n", (*gfr)->path);
+  int request_len = snprintf((*gfr)->request, BUFSIZE, "GETFILE GET %s", (*gfr)->path);
+  if ((*gfr)->ifnonematch && request_len < BUFSIZE) {
+    request_len += snprintf((*gfr)->request + request_len, BUFSIZE - request_len, GF_IF_NONE_MATCH "%s", (*gfr)->ifnonematch);
+  }
+  if ((*gfr)->acceptencoding && request_len < BUFSIZE) {
+    request_len += snprintf((*gfr)->request + request_len, BUFSIZE - request_len, GF_ACCEPT_ENCODING "%s", (*gfr)->acceptencoding);
+  }
+  if (request_len < BUFSIZE) {
+    snprintf((*gfr)->request + request_len, BUFSIZE - request_len, "\r\n\r\n");
+  }
 
   // Send loop for the getfile request
   ssize_t bytes_request = strlen((*gfr)->request);
@@ -220,12 +562,11 @@ int gfc_perform(gfcrequest_t **gfr) {
   // for memory leak reduce
   free((*gfr)->request); 
 
-  printf("receiving getfile response");
+  L(DEBUG, "receiving getfile response");
 
   // File handling declarations for receiving 
   char buffer[BUFSIZE]; // buffer containing received data
   char content[BUFSIZE]; // buffer containing received content
-  char header[BUFSIZE]; // buffer containing received header
   int current_bytes_received; // current bytes received
   bool header_received = false; // indicator of whether header is received or not
   int sscanf_result = 0; // request file processing result indicator
@@ -237,7 +578,6 @@ int gfc_perform(gfcrequest_t **gfr) {
     // clear the buffers at the loop start
     memset(buffer, '\0', BUFSIZE);
     memset(content, '\0', BUFSIZE);
-    memset(header, '\0', BUFSIZE);
 
     // receive data
     current_bytes_received = recv((*gfr)->socket_fd, buffer, BUFSIZE, 0);
@@ -283,12 +623,47 @@ int gfc_perform(gfcrequest_t **gfr) {
 
         // Validate the status obtained from the header
         int valid_result = validate_status(gfr, header_status);
-
-        // If the status is valid and we received the expected length, set the file length
         if (valid_result == 1) {
           (*gfr)->file_length = expected_len;
-        } else {
-          // If the status is not valid, break from the loop (or current processing block)
+
+          // Servers that checksum their content add " crc32c=<hex>" after the length
+          unsigned int digest;
+          if (sscanf(header_end, "GETFILE OK %*u crc32c=%8x", &digest) == 1) {
+            (*gfr)->has_digest = true;
+            (*gfr)->digest = digest;
+          }
+
+          // An encoded body is followed by its encoding and the decoded length,
+          // which the digest and the tag describe
+          size_t tag_len = expected_len;
+          char *encoding = strstr(header_end, GF_ENCODING_FIELD);
+          if (encoding) {
+            char token[16];
+            if (sscanf(encoding, GF_ENCODING_FIELD "%15s" GF_LENGTH_FIELD "%zu", token, &(*gfr)->decoded_length) != 2 ||
+                strcmp(token, GF_ENCODING_GZIP) != 0 || inflateInit2(&(*gfr)->inflater, GZIP_WINDOW) != Z_OK) {
+              L(ERROR, "cannot decode the body of %s", (*gfr)->path);
+              (*gfr)->status = GF_INVALID;
+              valid_result = -1;
+            } else {
+              (*gfr)->encoded = true;
+              (*gfr)->inflate_status = Z_OK;
+              tag_len = (*gfr)->decoded_length;
+            }
+          }
+          if ((*gfr)->has_digest) {
+            snprintf((*gfr)->tag, sizeof((*gfr)->tag), GF_TAG_FORMAT, tag_len, (*gfr)->digest);
+          }
+        }
+
+        // Hand the raw header to the header callback, once, before any body
+        // byte, so the caller can prepare for the announced length.
+        char *raw_end = memmem(content, current_bytes_received, "\r\n\r\n", 4);
+        if ((*gfr)->headerfunc && raw_end) {
+          (*gfr)->headerfunc(content, raw_end + 4 - content, (*gfr)->headerarg);
+        }
+
+        // If the status is not valid, stop once the caller has seen the header
+        if (valid_result != 1) {
           break;
         }
         
@@ -298,18 +673,30 @@ int gfc_perform(gfcrequest_t **gfr) {
         }
       }
 
-      // populate header in the right format
-      sprintf(header, "GETFILE %s %zu\r\n\r\n", header_status, gfc_get_filelen(gfr));
-
-      size_t header_size = strlen(header); // size of the header
+      // the body starts right after the blank line, whatever fields the header carried
+      char *body_start = memmem(content, current_bytes_received, "\r\n\r\n", 4);
+      size_t header_size = body_start ? (size_t)(body_start + 4 - content) : (size_t)current_bytes_received;
 
       // process any content in the current bytes
       int bytes_processing = current_bytes_received - header_size;
       (*gfr)->bytes_received += bytes_processing;
 
       // write content with the header
-      if ((*gfr)->writefunc && gfc_get_status(gfr) == GF_OK) {
-        (*gfr)->writefunc(content + header_size, bytes_processing, (*gfr)->writearg);
+      if (gfc_get_status(gfr) == GF_OK) {
+        deliver(gfr, content + header_size, bytes_processing);
+      }
+
+      // With a sink the rest of the body skips the small receive loop.
+      // Splicing never brings the bytes into user space, so it is only
+      // used when there is no digest to fold them into or body to inflate.
+      if ((*gfr)->sink_fd >= 0 && gfc_get_status(gfr) == GF_OK) {
+#if defined(__linux__)
+        if ((*gfr)->has_digest || (*gfr)->encoded || splice_body(gfr, expected_len - (*gfr)->bytes_received) < 0)
+          receive_body(gfr, expected_len - (*gfr)->bytes_received);
+#else
+        receive_body(gfr, expected_len - (*gfr)->bytes_received);
+#endif
+        break;
       }
       
       // process content if header already received
@@ -321,7 +708,7 @@ int gfc_perform(gfcrequest_t **gfr) {
       }
 
       // write content without header
-      (*gfr)->writefunc(content, current_bytes_received, (*gfr)->writearg);
+      deliver(gfr, content, current_bytes_received);
       (*gfr)->bytes_received += current_bytes_received;
     }
 
@@ -331,11 +718,36 @@ int gfc_perform(gfcrequest_t **gfr) {
     }
   }
 
-  // debugger
-  printf("Current getfile status is %d, bytes received is %lu, file length is %lu, sscanf_result is %d", gfc_get_status(gfr), gfc_get_bytesreceived(gfr), gfc_get_filelen(gfr), sscanf_result);
+  // the whole response has been read, whatever its status
+  close((*gfr)->socket_fd);
+
+  // From here on the caller sees the decoded file: a body that arrived
+  // whole but does not inflate to the announced length is corrupt
+  if ((*gfr)->encoded) {
+    bool whole = gfc_get_bytesreceived(gfr) == gfc_get_filelen(gfr);
+    inflateEnd(&(*gfr)->inflater);
+    (*gfr)->encoded = false;
+    (*gfr)->bytes_received = (*gfr)->decoded;
+    (*gfr)->file_length = (*gfr)->decoded_length;
+    if (gfc_get_status(gfr) == GF_OK && whole &&
+        ((*gfr)->inflate_status != Z_STREAM_END || (*gfr)->decoded != (*gfr)->decoded_length)) {
+      L(ERROR, "gzip body of %s does not decode to %zu bytes", (*gfr)->path, (*gfr)->decoded_length);
+      return -1;
+    }
+  }
+
+  // debugger, compiled out unless built with -DMYLOG_PRIORITY=DEBUG
+  L(DEBUG, "Current getfile status is %d, bytes received is %lu, file length is %lu, sscanf_result is %d", gfc_get_status(gfr), gfc_get_bytesreceived(gfr), gfc_get_filelen(gfr), sscanf_result);
+
+  // a complete body that does not match the announced digest was corrupted on the way
+  if (gfc_get_status(gfr) == GF_OK && (*gfr)->has_digest &&
+      gfc_get_bytesreceived(gfr) == gfc_get_filelen(gfr) && (*gfr)->crc != (*gfr)->digest) {
+    L(ERROR, "checksum mismatch for %s: expected crc32c %08x, received %08x", (*gfr)->path, (*gfr)->digest, (*gfr)->crc);
+    return -1;
+  }
 
   // return the appropriate status code after performing the tasks
-  if (gfc_get_status(gfr) == GF_ERROR || gfc_get_status(gfr) == GF_FILE_NOT_FOUND) {
+  if (gfc_get_status(gfr) == GF_ERROR || gfc_get_status(gfr) == GF_FILE_NOT_FOUND || gfc_get_status(gfr) == GF_NOT_MODIFIED) {
     return 0;
   } else if ((gfc_get_status(gfr) == GF_OK) && (gfc_get_bytesreceived(gfr) == gfc_get_filelen(gfr))) {
     return 0;
@@ -372,6 +784,38 @@ void gfc_set_writefunc(gfcrequest_t **gfr, void (*writefunc)(void *, size_t, voi
   (*gfr)->writefunc = writefunc;
 }
 
+void gfc_set_sink(gfcrequest_t **gfr, int fd) {
+  (*gfr)->sink_fd = fd;
+}
+
+void gfc_set_paths(gfcrequest_t **gfr, const char **paths, size_t npaths) {
+  (*gfr)->paths = paths;
+  (*gfr)->npaths = npaths;
+}
+
+void gfc_set_memberfunc(gfcrequest_t **gfr, void (*memberfunc)(size_t, gfstatus_t, size_t, void *)) {
+  (*gfr)->memberfunc = memberfunc;
+}
+
+void gfc_set_memberarg(gfcrequest_t **gfr, void *memberarg) {
+  (*gfr)->memberarg = memberarg;
+}
+
+void gfc_set_ifnonematch(gfcrequest_t **gfr, const char *tag) {
+  (*gfr)->ifnonematch = tag;
+}
+
+void gfc_set_acceptencoding(gfcrequest_t **gfr, const char *encodings) {
+  (*gfr)->acceptencoding = encodings;
+}
+
+const char *gfc_get_tag(gfcrequest_t **gfr) {
+  if ((*gfr)->status != GF_OK || !(*gfr)->has_digest) {
+    return NULL;
+  }
+  return (*gfr)->tag;
+}
+
 const char *gfc_strstatus(gfstatus_t status) {
   const char *strstatus = "UNKNOWN";
 
@@ -393,6 +837,10 @@ const char *gfc_strstatus(gfstatus_t status) {
       strstatus = "ERROR";
     } break;
 
+   case GF_NOT_MODIFIED: {
+      strstatus = "NOT_MODIFIED";
+    } break;
+
   }
 
   return strstatus;
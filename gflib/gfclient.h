@@ -13,7 +13,8 @@ typedef enum{
   GF_OK = 0,
   GF_FILE_NOT_FOUND = (GF_OK + 1),
   GF_ERROR = (GF_OK + 2),
-  GF_INVALID = (GF_OK + 3)
+  GF_INVALID = (GF_OK + 3),
+  GF_NOT_MODIFIED = (GF_OK + 4)
 } gfstatus_t;
 
 /*struct for a getfile request*/
@@ -83,13 +84,69 @@ void gfc_set_writearg(gfcrequest_t **gfr, void *writearg);
  */
 void gfc_set_writefunc(gfcrequest_t **gfr, void (*writefunc)(void *data_buffer, size_t data_buffer_length, void *handlerarg));
 
+/*
+ * Sets a file descriptor that receives the body instead of the write
+ * callback.  The body is then written straight to fd at its current
+ * offset: spliced from the socket without passing through user space
+ * where the platform allows it, otherwise received in large buffers and
+ * written with write(2).  The length comes from the response header.
+ * A negative fd (the default) goes back to the write callback.
+ */
+void gfc_set_sink(gfcrequest_t **gfr, int fd);
+
+/*
+ * Turns the request into a batch for the npaths paths in paths, all
+ * answered in one response, instead of the single path set with
+ * gfc_set_path.  Each file is announced to the member callback and its
+ * body, if any, follows through the write callback (or the sink).  At
+ * most GF_MGET_MAX_PATHS paths; the array must outlive gfc_perform.
+ */
+void gfc_set_paths(gfcrequest_t **gfr, const char **paths, size_t npaths);
+
+/*
+ * Sets the callback for the start of each file of a batch.  It receives
+ * the index of the file's path, its status, its length and the pointer
+ * registered with gfc_set_memberarg, before any byte of its body.  A file
+ * whose body then fails its checksum or is cut short is reported again
+ * with GF_ERROR once its bytes have been delivered.
+ */
+void gfc_set_memberfunc(gfcrequest_t **gfr, void (*memberfunc)(size_t index, gfstatus_t status, size_t file_len, void *memberarg));
+
+/*
+ * Sets the fourth argument for all calls to the member callback.
+ */
+void gfc_set_memberarg(gfcrequest_t **gfr, void *memberarg);
+
+/*
+ * Makes the request conditional on tag, a version tag previously
+ * returned by gfc_get_tag for the same path.  If the server's file still
+ * has that tag the response is NOT_MODIFIED with no body, and neither
+ * the write callback nor the sink is used.  NULL (the default) asks for
+ * the file unconditionally.  The string must outlive gfc_perform.
+ */
+void gfc_set_ifnonematch(gfcrequest_t **gfr, const char *tag);
+
+/*
+ * Offers the server the encodings in encodings, a comma-separated list,
+ * for the body.  The library only decodes "gzip": an encoded body is
+ * inflated as it arrives, so the write callback, the sink, the file
+ * length, the bytes received and the digest all concern the decoded
+ * file.  NULL (the default) asks for the raw bytes.  The string must
+ * outlive gfc_perform.  Batches are never encoded.
+ */
+void gfc_set_acceptencoding(gfcrequest_t **gfr, const char *encodings);
+
 /*
  * Performs the transfer as described in the options.  Returns a value of 0
  * if the communication is successful, including the case where the server
- * returns a response with a FILE_NOT_FOUND or ERROR response.  If the
+ * returns a response with a FILE_NOT_FOUND, NOT_MODIFIED or ERROR response.
+ * For a batch the status is that of the response as a whole, and the
+ * file length and bytes received are totals over its files.  If the
  * communication is not successful (e.g. the connection is closed before
  * transfer is complete or an invalid header is returned), then a negative
- * integer will be returned.
+ * integer will be returned.  When the OK header carries a CRC32C of the
+ * file, the body is checksummed as it arrives and a mismatch is also
+ * reported as a negative value.
  */
 int gfc_perform(gfcrequest_t **gfr);
 
@@ -104,6 +161,13 @@ gfstatus_t gfc_get_status(gfcrequest_t **gfr);
  */
 size_t gfc_get_filelen(gfcrequest_t **gfr);
 
+/*
+ * Returns the version tag of the file received, for a later
+ * gfc_set_ifnonematch, or NULL if the response was not OK or did not
+ * carry a digest.  The string belongs to the request.
+ */
+const char *gfc_get_tag(gfcrequest_t **gfr);
+
 /*
  * Returns actual number of bytes received before the connection is closed.
  * This may be distinct from the result of gfc_get_filelen when the response
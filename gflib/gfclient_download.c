@@ -1,5 +1,6 @@
 #include <regex.h>
 #include <stdlib.h>
+#include <fcntl.h>
 
 #include "gfclient.h"
 #include "workload.h"
@@ -7,6 +8,7 @@
 
 #define BUFSIZE 1024
 #define PATH_BUFFER_SIZE 256
+#define TAG_BUCKETS 1024
 
 #define USAGE                                                             \
   "usage:\n"                                                              \
@@ -16,7 +18,10 @@
   "  -p [server_port]    Server port (Default: 47293)\n"                  \
   "  -w [workload_path]  Path to workload file (Default: workload.txt)\n" \
   "  -s [server_addr]    Server address (Default: 127.0.0.1)\n"           \
-  "  -n [num_requests]   Request download total (Default: 14)\n"
+  "  -n [num_requests]   Request download total (Default: 14)\n"          \
+  "  -c [tag_store]      Version tag store (Default: none)\n"             \
+  "  -b [batch_size]     Files per MGET request (Default: 1)\n"           \
+  "  -z                  Accept gzip-encoded bodies\n"
 
 /* OPTIONS DESCRIPTOR ====================================================== */
 static struct option gLongOptions[] = {
@@ -25,6 +30,9 @@ static struct option gLongOptions[] = {
     {"workload", required_argument, NULL, 'w'},
     {"port", required_argument, NULL, 'p'},
     {"nrequests", required_argument, NULL, 'n'},
+    {"tags", required_argument, NULL, 'c'},
+    {"batch", required_argument, NULL, 'b'},
+    {"gzip", no_argument, NULL, 'z'},
     {NULL, 0, NULL, 0}};
 
 static void Usage() { fprintf(stdout, "%s", USAGE); }
@@ -35,9 +43,9 @@ static void localPath(char *req_path, char *local_path) {
   snprintf(local_path, PATH_BUFFER_SIZE, "%s_%06d", &req_path[1], counter++);
 }
 
-static FILE *openFile(char *path) {
+static int openFile(char *path, int flags) {
   char *cur, *prev;
-  FILE *ans;
+  int ans;
 
   /* Make the directory if it isn't there */
   prev = path;
@@ -55,7 +63,7 @@ static FILE *openFile(char *path) {
     prev = cur;
   }
 
-  if (NULL == (ans = fopen(&path[0], "w"))) {
+  if (0 > (ans = open(&path[0], O_WRONLY | O_CREAT | flags, 0666))) {
     perror("Unable to open file");
     exit(EXIT_FAILURE);
   }
@@ -63,11 +71,249 @@ static FILE *openFile(char *path) {
   return ans;
 }
 
+/* Sizes the file for its body; a copy refreshed in place may be longer */
+static void preallocate(int fd, size_t file_len) {
+  if (0 > ftruncate(fd, file_len))
+    perror("Unable to size file");
+  else if (file_len > 0)
+    posix_fallocate(fd, 0, file_len);
+}
+
+/* Tag store ========================================================= */
+
+/*
+ * Version tag of the local copy of each path, so a later run can ask the
+ * server for the path only if it changed.  Kept in a text file with one
+ * "<path> <tag> <local copy>" line per path.
+ */
+typedef struct tag_entry_t {
+  char *path;
+  char *local;
+  char tag[GF_TAG_MAX];
+  struct tag_entry_t *next;
+} tag_entry_t;
+
+static tag_entry_t *tags[TAG_BUCKETS];
+
+static unsigned int tagHash(const char *path) {
+  unsigned int hash = 2166136261u;
+
+  while (*path)
+    hash = (hash ^ (unsigned char)*path++) * 16777619u;
+  return hash & (TAG_BUCKETS - 1);
+}
+
+static tag_entry_t *tagFind(const char *path) {
+  tag_entry_t *entry;
+
+  for (entry = tags[tagHash(path)]; entry; entry = entry->next)
+    if (0 == strcmp(entry->path, path))
+      return entry;
+  return NULL;
+}
+
+static void tagSet(const char *path, const char *tag, const char *local) {
+  tag_entry_t *entry = tagFind(path);
+
+  if (NULL == entry) {
+    unsigned int bucket = tagHash(path);
+
+    entry = calloc(1, sizeof(tag_entry_t));
+    entry->path = strdup(path);
+    entry->next = tags[bucket];
+    tags[bucket] = entry;
+  } else {
+    free(entry->local);
+  }
+  entry->local = strdup(local);
+  snprintf(entry->tag, sizeof(entry->tag), "%s", tag);
+}
+
+/* A missing store is an empty one: the first run fetches everything. */
+static void tagLoad(const char *store) {
+  char path[PATH_BUFFER_SIZE + 1], tag[GF_TAG_MAX], local[PATH_BUFFER_SIZE + 1];
+  FILE *in;
+
+  if (NULL == (in = fopen(store, "r")))
+    return;
+  while (3 == fscanf(in, "%256s %31s %256s", path, tag, local))
+    tagSet(path, tag, local);
+  fclose(in);
+}
+
+/* Rewrites the store through a temporary file so an interrupted run keeps the old one. */
+static void tagSave(const char *store) {
+  char tmp[PATH_BUFFER_SIZE + 8];
+  tag_entry_t *entry;
+  FILE *out;
+  int i;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", store);
+  if (NULL == (out = fopen(tmp, "w"))) {
+    perror("Unable to write tag store");
+    return;
+  }
+  for (i = 0; i < TAG_BUCKETS; i++)
+    for (entry = tags[i]; entry; entry = entry->next)
+      fprintf(out, "%s %s %s\n", entry->path, entry->tag, entry->local);
+  if (0 != fclose(out) || 0 > rename(tmp, store))
+    perror("Unable to write tag store");
+}
+
+static void tagDestroy() {
+  tag_entry_t *entry, *next;
+  int i;
+
+  for (i = 0; i < TAG_BUCKETS; i++) {
+    for (entry = tags[i]; entry; entry = next) {
+      next = entry->next;
+      free(entry->path);
+      free(entry->local);
+      free(entry);
+    }
+    tags[i] = NULL;
+  }
+}
+
 /* Callbacks ========================================================= */
+
+/* The local file of a single download */
+typedef struct {
+  int fd;
+  int rewritten;  // sized for an OK body, so the previous copy is gone
+} sink_t;
+
+static void headercb(void *header, size_t header_len, void *arg) {
+  sink_t *sink = (sink_t *)arg;
+  char text[128], status[16], *decoded;
+  size_t file_len;
+
+  /* The header is not NUL-terminated */
+  if (header_len >= sizeof(text))
+    header_len = sizeof(text) - 1;
+  memcpy(text, header, header_len);
+  text[header_len] = '\0';
+
+  if (2 != sscanf(text, "GETFILE %15s %zu", status, &file_len) || 0 != strcmp(status, "OK"))
+    return;
+
+  /* An encoded body is inflated into the file, so size it for the decoded length */
+  if (NULL != (decoded = strstr(text, GF_LENGTH_FIELD)))
+    sscanf(decoded, GF_LENGTH_FIELD "%zu", &file_len);
+  preallocate(sink->fd, file_len);
+  sink->rewritten = 1;
+}
+
+/* Batches ========================================================= */
+
+/*
+ * Files of one MGET request.  Each member gets its local file when the
+ * library announces it, and its body is written there until the next.
+ */
+typedef struct {
+  char **paths;
+  char (*local)[PATH_BUFFER_SIZE];
+  gfstatus_t *status;
+  size_t *len;
+  int fd; // file of the member being received, -1 if none
+} batch_t;
+
+static void batchClose(batch_t *batch) {
+  if (batch->fd >= 0)
+    close(batch->fd);
+  batch->fd = -1;
+}
+
+static void membercb(size_t index, gfstatus_t status, size_t file_len, void *arg) {
+  batch_t *batch = (batch_t *)arg;
+
+  batchClose(batch);
+
+  /* Announced again with an error: its body is corrupt or incomplete */
+  if (GF_OK == batch->status[index] && GF_OK != status) {
+    if (0 > unlink(batch->local[index]))
+      fprintf(stderr, "warning: unlink failed on %s\n", batch->local[index]);
+  }
+
+  batch->status[index] = status;
+  batch->len[index] = file_len;
+  if (GF_OK != status)
+    return;
+
+  localPath(batch->paths[index], batch->local[index]);
+  batch->fd = openFile(batch->local[index], O_TRUNC);
+  preallocate(batch->fd, file_len);
+}
+
 static void writecb(void *data, size_t data_len, void *arg) {
-  FILE *file = (FILE *)arg;
+  batch_t *batch = (batch_t *)arg;
+  char *cursor = (char *)data;
+  ssize_t written;
+
+  while (data_len > 0) {
+    if (0 > (written = write(batch->fd, cursor, data_len))) {
+      if (EINTR == errno)
+        continue;
+      perror("Unable to write file");
+      return;
+    }
+    cursor += written;
+    data_len -= written;
+  }
+}
+
+/* Downloads nrequests workload paths, batch_size of them per request. */
+static void downloadBatches(char *server, unsigned short port, int nrequests, int batch_size) {
+  batch_t batch;
+  gfcrequest_t *gfr;
+  int returncode, i, n, j;
+
+  batch.paths = malloc(batch_size * sizeof(char *));
+  batch.local = malloc(batch_size * sizeof(*batch.local));
+  batch.status = malloc(batch_size * sizeof(gfstatus_t));
+  batch.len = malloc(batch_size * sizeof(size_t));
+  batch.fd = -1;
+
+  for (i = 0; i < nrequests; i += n) {
+    n = nrequests - i < batch_size ? nrequests - i : batch_size;
+    for (j = 0; j < n; j++) {
+      batch.paths[j] = workload_get_path();
+      if (strlen(batch.paths[j]) > 256) {
+        fprintf(stderr, "Request path exceeded maximum of 256 characters\n.");
+        exit(EXIT_FAILURE);
+      }
+      batch.status[j] = GF_INVALID;
+      batch.len[j] = 0;
+    }
+
+    gfr = gfc_create();
+    gfc_set_port(&gfr, port);
+    gfc_set_server(&gfr, server);
+    gfc_set_paths(&gfr, (const char **)batch.paths, n);
+    gfc_set_memberfunc(&gfr, membercb);
+    gfc_set_memberarg(&gfr, &batch);
+    gfc_set_writefunc(&gfr, writecb);
+    gfc_set_writearg(&gfr, &batch);
+
+    fprintf(stdout, "Requesting %d files from %s\n", n, server);
+
+    if (0 > (returncode = gfc_perform(&gfr)))
+      fprintf(stdout, "gfc_perform returned error %d\n", returncode);
+    batchClose(&batch);
+
+    for (j = 0; j < n; j++) {
+      fprintf(stdout, "Requested %s%s\n", server, batch.paths[j]);
+      fprintf(stdout, "Received:: %zu of %zu bytes\n", GF_OK == batch.status[j] ? batch.len[j] : 0, batch.len[j]);
+      fprintf(stdout, "Status: %s\n", gfc_strstatus(batch.status[j]));
+    }
 
-  fwrite(data, 1, data_len, file);
+    gfc_cleanup(&gfr);
+  }
+
+  free(batch.paths);
+  free(batch.local);
+  free(batch.status);
+  free(batch.len);
 }
 
 /* Main ========================================================= */
@@ -77,12 +323,16 @@ int main(int argc, char **argv) {
   gfcrequest_t *gfr;
   char *workload_path = "workload.txt";
   int nrequests = 15;
+  int batch_size = 1;
   int option_char = 0;
 
-  FILE *file;
+  sink_t file;
   int returncode;
   char *req_path;
   char local_path[PATH_BUFFER_SIZE];
+  char *tag_store = NULL;
+  char *accept_encoding = NULL;
+  tag_entry_t *known;
 
   char *server = "localhost";
   unsigned short port = 47293;
@@ -90,7 +340,7 @@ int main(int argc, char **argv) {
   setbuf(stdout, NULL);  // disable buffering
 
   // Parse and set command line arguments
-  while ((option_char = getopt_long(argc, argv, "l:r:hp:s:n:", gLongOptions,
+  while ((option_char = getopt_long(argc, argv, "l:r:hp:s:n:c:b:z", gLongOptions,
                                     NULL)) != -1) {
     switch (option_char) {
       case 'r':
@@ -111,6 +361,15 @@ int main(int argc, char **argv) {
       case 'w':  // workload-path
         workload_path = optarg;
         break;
+      case 'c':  // tag store
+        tag_store = optarg;
+        break;
+      case 'b':  // files per request
+        batch_size = atoi(optarg);
+        break;
+      case 'z':  // accept gzip
+        accept_encoding = GF_ENCODING_GZIP;
+        break;
       default:
         exit(1);
     }
@@ -126,8 +385,23 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
+  if (batch_size < 1 || batch_size > GF_MGET_MAX_PATHS) {
+    fprintf(stderr, "Invalid batch size\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (tag_store)
+    tagLoad(tag_store);
+
   gfc_global_init();
 
+  /* Batches are not conditional, so they leave the tag store alone;
+     once they are done the single-file loop below has nothing left */
+  if (batch_size > 1) {
+    downloadBatches(server, port, nrequests, batch_size);
+    nrequests = 0;
+  }
+
   /*Making the requests...*/
   for (int i = 0; i < nrequests; i++) {
     req_path = workload_get_path();
@@ -137,9 +411,20 @@ int main(int argc, char **argv) {
       exit(EXIT_FAILURE);
     }
 
-    localPath(req_path, local_path);
+    // A copy we still have is revalidated in place and only rewritten,
+    // from the header callback on, if the server says it changed
+    known = tag_store ? tagFind(req_path) : NULL;
+    if (known && 0 != access(known->local, F_OK))
+      known = NULL;
 
-    file = openFile(local_path);
+    if (known) {
+      snprintf(local_path, PATH_BUFFER_SIZE, "%s", known->local);
+      file.fd = openFile(local_path, 0);
+    } else {
+      localPath(req_path, local_path);
+      file.fd = openFile(local_path, O_TRUNC);
+    }
+    file.rewritten = !known;
 
     gfr = gfc_create();
 
@@ -148,21 +433,26 @@ int main(int argc, char **argv) {
     gfc_set_server(&gfr, server);
 
 
-    gfc_set_writefunc(&gfr, writecb);
-    gfc_set_writearg(&gfr, file);
+    // The library writes the body straight into the file
+    gfc_set_sink(&gfr, file.fd);
+    gfc_set_headerfunc(&gfr, headercb);
+    gfc_set_headerarg(&gfr, &file);
+    if (known)
+      gfc_set_ifnonematch(&gfr, known->tag);
+    gfc_set_acceptencoding(&gfr, accept_encoding);
 
     fprintf(stdout, "Requesting %s%s\n", server, req_path);
 
-    if (0 > (returncode = gfc_perform(&gfr))) {
+    // A failed download only removes a file this run created or rewrote;
+    // a revalidated copy the server did not replace is kept with its tag
+    returncode = gfc_perform(&gfr);
+    close(file.fd);
+    if (0 > returncode)
       fprintf(stdout, "gfc_perform returned error %d\n", returncode);
-      fclose(file);
-      if (0 > unlink(local_path))
-        fprintf(stderr, "warning: unlink failed on %s\n", local_path);
-    } else {
-      fclose(file);
-    }
+    else if (tag_store && gfc_get_tag(&gfr))
+      tagSet(req_path, gfc_get_tag(&gfr), local_path);
 
-    if (gfc_get_status(&gfr) != GF_OK) {
+    if (file.rewritten && (0 > returncode || (gfc_get_status(&gfr) != GF_OK && gfc_get_status(&gfr) != GF_NOT_MODIFIED))) {
       if (0 > unlink(local_path))
         fprintf(stderr, "warning: unlink failed on %s\n", local_path);
     }
@@ -177,6 +467,11 @@ int main(int argc, char **argv) {
 
   gfc_global_cleanup();
 
+  if (tag_store) {
+    tagSave(tag_store);
+    tagDestroy();
+  }
+
   workload_destroy();  // clean up workload package
 
   return 0;
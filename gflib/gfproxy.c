@@ -0,0 +1,307 @@
+#include <errno.h>
+#include <stdio.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "cache.h"
+#include "gfserver.h"
+#include "upstream.h"
+#include "gf-student.h"
+
+#define BUFSIZE (64 * 1024)
+#define MAX_THREADS 1024
+
+#define USAGE                                                                        \
+  "usage:\n"                                                                         \
+  "  gfproxy [options]\n"                                                            \
+  "options:\n"                                                                       \
+  "  -h                  Show this help message\n"                                   \
+  "  -p [listen_port]    Listen port (Default: 47294)\n"                             \
+  "  -s [server_addr]    Upstream server address (Default: localhost)\n"             \
+  "  -u [server_port]    Upstream server port (Default: 47293)\n"                    \
+  "  -t [nthreads]       Worker threads (Default: 8, Range: 1-1024)\n"               \
+  "  -c [cache_bytes]    Cache capacity in bytes, 0 for none (Default: 67108864)\n"  \
+  "  -e [policy]         Cache eviction policy, lru or fifo (Default: lru)\n"        \
+  "  -d [cache_dir]      Keep cached files in this directory instead of memory\n"
+
+/* OPTIONS DESCRIPTOR ====================================================== */
+static struct option gLongOptions[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"port", required_argument, NULL, 'p'},
+    {"server", required_argument, NULL, 's'},
+    {"upstream-port", required_argument, NULL, 'u'},
+    {"nthreads", required_argument, NULL, 't'},
+    {"cache-bytes", required_argument, NULL, 'c'},
+    {"policy", required_argument, NULL, 'e'},
+    {"cache-dir", required_argument, NULL, 'd'},
+    {NULL, 0, NULL, 0}};
+
+/* Requests taken from the server loop, served by the workers in order */
+typedef struct request_t {
+  gfcontext_t *ctx;
+  const char *path;  // owned by ctx
+  struct request_t *next;
+} request_t;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static request_t *queue_head;
+static request_t *queue_tail;
+
+/* A miss being fetched from the upstream by one worker */
+typedef struct {
+  gfcontext_t **ctx;
+  const char *path;
+  cache_entry_t *entry;  // filled as the body arrives for other workers and the cache, or NULL
+  bool answered;         // the client has its header
+  bool gone;             // the client went away; the entry is still filled
+  bool stored;           // the entry takes the body
+} fetch_t;
+
+/* The entry of the calling worker, whose header is being sent */
+static __thread cache_entry_t *current_entry;
+
+/*
+ * Digest callback of the server: the digest of the entry being sent, and
+ * the cached one for NOT_MODIFIED.
+ */
+static int proxy_digest(const char *path, size_t *size, uint32_t *digest) {
+  if (current_entry)
+    return cache_entry_digest(current_entry, size, digest);
+  return cache_digest(path, size, digest);
+}
+
+/* Callbacks ========================================================= */
+
+/* Passes the upstream status and length on before any byte of the body. */
+static void fetch_header(upstream_status_t status, size_t file_len, int has_digest, uint32_t digest, void *arg) {
+  fetch_t *fetch = (fetch_t *)arg;
+  int answer;
+
+  fetch->answered = true;
+  if (UPSTREAM_OK != status) {
+    answer = UPSTREAM_FILE_NOT_FOUND == status ? GF_FILE_NOT_FOUND : GF_ERROR;
+    if (fetch->entry)
+      cache_answer(fetch->entry, answer);  // the waiters answer the same
+    gfs_sendheader(fetch->ctx, answer, 0);
+    return;
+  }
+
+  if (NULL == fetch->entry) {
+    gfs_sendheader(fetch->ctx, GF_OK, file_len);
+    return;
+  }
+  fetch->stored = 0 == cache_begin(fetch->entry, file_len, has_digest, digest);
+
+  current_entry = fetch->entry;
+  gfs_sendheader(fetch->ctx, GF_OK, file_len);
+  current_entry = NULL;
+}
+
+/* Streams each chunk to the client and into the entry. */
+static void fetch_write(void *data, size_t len, void *arg) {
+  fetch_t *fetch = (fetch_t *)arg;
+
+  if (fetch->stored && 0 > cache_write(fetch->entry, data, len)) {
+    cache_fail(fetch->entry);
+    fetch->stored = false;
+  }
+  if (!fetch->gone && gfs_send(fetch->ctx, data, len) != len)
+    fetch->gone = true;
+}
+
+/* Serving ========================================================= */
+
+/*
+ * Sends the file of an entry, cached or still being fetched by another
+ * worker, as its bytes arrive, or the status the upstream answered it
+ * with.  Returns -1 if the fetch failed before the client got its header.
+ */
+static int serve_entry(gfcontext_t **ctx, cache_entry_t *entry, char *buffer) {
+  size_t size, offset = 0;
+  ssize_t got;
+  int status;
+
+  if (0 > (status = cache_wait(entry)))
+    return -1;
+  if (0 < status) {
+    gfs_sendheader(ctx, status, 0);
+    return 0;
+  }
+
+  size = cache_size(entry);
+  current_entry = entry;
+  gfs_sendheader(ctx, GF_OK, size);
+  current_entry = NULL;
+
+  while (offset < size && 0 < (got = cache_read(entry, buffer, BUFSIZE, offset))) {
+    if (gfs_send(ctx, buffer, got) != got)
+      break;
+    offset += got;
+  }
+  return 0;
+}
+
+/*
+ * Fetches a file from the upstream, sending it to the client as it
+ * arrives, and fills entry with it, unless it is NULL, for the workers
+ * waiting on it.  Only a complete body that passed its checksum is cached.
+ */
+static void serve_miss(gfcontext_t **ctx, const char *path, cache_entry_t *entry) {
+  fetch_t fetch = {ctx, path, entry, false, false, false};
+  int returncode;
+
+  returncode = upstream_fetch(path, fetch_header, fetch_write, &fetch);
+  if (!fetch.answered) {
+    if (entry)
+      cache_answer(entry, GF_ERROR);
+    gfs_sendheader(ctx, GF_ERROR, 0);  // the upstream could not be reached
+  }
+
+  if (entry) {
+    if (0 != returncode)
+      cache_fail(entry);
+    cache_put(entry);
+  }
+}
+
+static void *worker(void *arg) {
+  char *buffer = malloc(BUFSIZE);
+  cache_entry_t *entry;
+  request_t *request;
+  int fetch;
+
+  (void)arg;
+  for (;;) {
+    pthread_mutex_lock(&queue_lock);
+    while (NULL == queue_head)
+      pthread_cond_wait(&queue_cond, &queue_lock);
+    request = queue_head;
+    if (NULL == (queue_head = request->next))
+      queue_tail = NULL;
+    pthread_mutex_unlock(&queue_lock);
+
+    /* Concurrent misses on a path share the fetch of the first one */
+    entry = cache_join(request->path, &fetch);
+    if (fetch) {
+      serve_miss(&request->ctx, request->path, entry);
+    } else {
+      if (0 > serve_entry(&request->ctx, entry, buffer))
+        serve_miss(&request->ctx, request->path, NULL);  // e.g. no room to store it
+      cache_release(entry);
+    }
+
+    gfs_finish(&request->ctx);
+    free(request);
+  }
+  return NULL;
+}
+
+/* Takes each request from the server loop and queues it for a worker. */
+static gfh_error_t proxy_handler(gfcontext_t **ctx, const char *path, void *arg) {
+  request_t *request = malloc(sizeof(request_t));
+
+  (void)arg;
+  request->ctx = *ctx;
+  request->path = path;
+  request->next = NULL;
+
+  pthread_mutex_lock(&queue_lock);
+  if (queue_tail)
+    queue_tail->next = request;
+  else
+    queue_head = request;
+  queue_tail = request;
+  pthread_mutex_unlock(&queue_lock);
+  pthread_cond_signal(&queue_cond);
+
+  *ctx = NULL;
+  return 0;
+}
+
+/* Main ========================================================= */
+int main(int argc, char **argv) {
+  gfserver_t *gfs = NULL;
+  unsigned short port = 47294;
+  char *server = "localhost";
+  unsigned short server_port = 47293;
+  int option_char = 0;
+  int nthreads = 8;
+  size_t cache_bytes = 64 * 1024 * 1024;
+  char *policy = "lru";
+  char *cache_dir = NULL;
+  pthread_t thread;
+
+  setbuf(stdout, NULL);  // disable caching of standard output
+  signal(SIGPIPE, SIG_IGN);  // a client that goes away fails its send instead
+
+  // Parse and set command line arguments
+  while ((option_char = getopt_long(argc, argv, "hp:s:u:t:c:e:d:", gLongOptions, NULL)) != -1) {
+    switch (option_char) {
+      case 'p':  // listen-port
+        port = atoi(optarg);
+        break;
+      case 's':  // server
+        server = optarg;
+        break;
+      case 'u':  // upstream-port
+        server_port = atoi(optarg);
+        break;
+      case 't':  // nthreads
+        nthreads = atoi(optarg);
+        break;
+      case 'c':  // cache-bytes
+        cache_bytes = strtoull(optarg, NULL, 10);
+        break;
+      case 'e':  // policy
+        policy = optarg;
+        break;
+      case 'd':  // cache-dir
+        cache_dir = optarg;
+        break;
+      case 'h':  // help
+        fprintf(stdout, "%s", USAGE);
+        exit(0);
+        break;
+      default:
+        fprintf(stderr, "%s", USAGE);
+        exit(1);
+    }
+  }
+
+  if (nthreads < 1 || nthreads > MAX_THREADS) {
+    fprintf(stderr, "Invalid number of threads\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (0 > cache_init(cache_bytes, policy, cache_dir)) {
+    fprintf(stderr, "Unknown cache policy %s\n", policy);
+    exit(EXIT_FAILURE);
+  }
+
+  upstream_init(server, server_port);
+
+  for (int i = 0; i < nthreads; i++) {
+    if (0 != pthread_create(&thread, NULL, worker, NULL) || 0 != pthread_detach(thread)) {
+      fprintf(stderr, "Unable to start worker threads\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /*Initializing server*/
+  gfs = gfserver_create();
+
+  /*Setting options*/
+  gfserver_set_handler(&gfs, proxy_handler);
+  gfserver_set_digestfunc(&gfs, proxy_digest);
+  gfserver_set_port(&gfs, port);
+  gfserver_set_maxpending(&gfs, 25);
+  gfserver_set_handlerarg(&gfs, NULL);
+
+  // Run forever
+  gfserver_serve(&gfs);
+}
@@ -1,5 +1,11 @@
 #include "gfserver-student.h"
 
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 // Modify this file to implement the interface specified in
  // gfserver.h.
 
@@ -9,21 +15,71 @@
 #define GF_STATUS_OK_MSG "GETFILE OK "
 #define GF_STATUS_NOT_FOUND_MSG "GETFILE FILE_NOT_FOUND \r\n\r\n"
 #define GF_STATUS_ERROR_MSG "GETFILE ERROR \r\n\r\n"
+#define GF_STATUS_NOT_MODIFIED_MSG "GETFILE NOT_MODIFIED\r\n\r\n"
 #define GF_STATUS_INVALID_MSG "GETFILE INVALID\r\n\r\n"
 #define GF_LINE_END "\r\n\r\n"
+#define GF_MGET_BUFSIZE (64 * 1024) // copy buffer where sendfile is unavailable
+
+
+#define GF_DIGEST_FIELD " crc32c="
+#define GF_DIGEST_DIGITS 8
+
+/* "GETFILE OK " + up to 20 digits + " crc32c=" + 8 hex digits + "\r\n\r\n" */
+#define GF_OK_HEADER_MAX (sizeof(GF_STATUS_OK_MSG) - 1 + 20 + sizeof(GF_DIGEST_FIELD) - 1 + GF_DIGEST_DIGITS + sizeof(GF_LINE_END))
+
+/* the OK header plus " encoding=gzip length=" and up to 20 more digits */
+#define GF_ENCODED_HEADER_MAX (GF_OK_HEADER_MAX + sizeof(GF_ENCODING_FIELD GF_ENCODING_GZIP GF_LENGTH_FIELD) - 1 + 20)
+
+/*  Writes "GETFILE OK <file_len>\r\n\r\n" into header without going through
+    printf-style formatting, with " crc32c=<digest>" after the length when
+    has_digest is set. Clients that only read the status and the length
+    never look past the length. Returns the header length. */
+static size_t format_ok_header(char *header, size_t file_len, int has_digest, uint32_t digest) {
+    static const char hex[] = "0123456789abcdef";
+    char digits[20];
+    size_t ndigits = 0;
+    size_t len = sizeof(GF_STATUS_OK_MSG) - 1;
+    int shift;
 
+    do {
+        digits[ndigits++] = '0' + (file_len % 10);
+        file_len /= 10;
+    } while (file_len > 0);
+
+    memcpy(header, GF_STATUS_OK_MSG, len);
+    while (ndigits > 0) {
+        header[len++] = digits[--ndigits];
+    }
+    if (has_digest) {
+        memcpy(header + len, GF_DIGEST_FIELD, sizeof(GF_DIGEST_FIELD) - 1);
+        len += sizeof(GF_DIGEST_FIELD) - 1;
+        for (shift = 28; shift >= 0; shift -= 4) {
+            header[len++] = hex[(digest >> shift) & 0xf];
+        }
+    }
+    memcpy(header + len, GF_LINE_END, sizeof(GF_LINE_END) - 1);
+    return len + sizeof(GF_LINE_END) - 1;
+}
 
 /* Define GetFile context data structure. */
 struct gfcontext_t {
     // client context
     int socket_fd; // file desrciptor of the client socket
     size_t file_length; // length of the file in context
+    char path[BUFSIZE]; // requested path, for the digest lookup; "" until a request is parsed
+    int (*digestfunc)(const char *, size_t *, uint32_t *); // digest lookup, NULL if unset
 };
 
 void gfs_abort(gfcontext_t **ctx){
     close((*ctx)->socket_fd);
 }
 
+void gfs_finish(gfcontext_t **ctx){
+    close((*ctx)->socket_fd);
+    free(*ctx);
+    *ctx = NULL;
+}
+
 ssize_t gfs_send(gfcontext_t **ctx, const void *data, size_t len){
     /* Keep sending data to client in context until the required length of bytes is sent. Returns the total bytes sent at the end. */
 
@@ -53,36 +109,243 @@ ssize_t gfs_sendheader(gfcontext_t **ctx, gfstatus_t status, size_t file_len) {
     /*  Sends the header depending on the status. 
         If FILE_NOT_FOUND, send "GETFILE FILE_NOT_FOUND \r\n\r\n"; 
         If ERROR, send "GETFILE ERROR \r\n\r\n"; 
+        If NOT_MODIFIED, send "GETFILE NOT_MODIFIED\r\n\r\n";
         If INVALID, send "GETFILE INVALID \r\n\r\n";
         If OK, send "GETFILE OK %zu \r\n\r\n" and set context file length.
+        The OK header also carries the CRC32C of the file when the digest
+        callback knows the path and its length matches file_len, so a file
+        that changed since it was checksummed is sent without one.
+        The fixed responses are sent straight from their constants; only the
+        OK header is formatted, into a buffer sized for the longest length.
         Returns the total bytes send at the end.
         */
 
-    ssize_t total_bytes_sent = 0;
-    char response[BUFSIZE];
+    char response[GF_OK_HEADER_MAX];
+    const char *header;
+    size_t header_len;
+    size_t digest_len;
+    uint32_t digest;
+    int has_digest;
 
     switch (status) {
         case GF_FILE_NOT_FOUND:
-            snprintf(response, sizeof(response), "%s", GF_STATUS_NOT_FOUND_MSG);
+            header = GF_STATUS_NOT_FOUND_MSG;
+            header_len = sizeof(GF_STATUS_NOT_FOUND_MSG) - 1;
             break;
         case GF_OK:
             (*ctx)->file_length = file_len;
-            int bytes_written = snprintf(response, sizeof(response), "%s%zu%s", GF_STATUS_OK_MSG, file_len, GF_LINE_END);
-            if (bytes_written < 0 || bytes_written >= sizeof(response)) {
-                // Handle error: snprintf writing error or not enough space in response buffer
-                return -1;
-            }
+            has_digest = (*ctx)->digestfunc && (*ctx)->path[0] &&
+                (*ctx)->digestfunc((*ctx)->path, &digest_len, &digest) == 0 &&
+                digest_len == file_len;
+            header = response;
+            header_len = format_ok_header(response, file_len, has_digest, digest);
             break;
         case GF_ERROR:
-            snprintf(response, sizeof(response), "%s", GF_STATUS_ERROR_MSG);
+            header = GF_STATUS_ERROR_MSG;
+            header_len = sizeof(GF_STATUS_ERROR_MSG) - 1;
+            break;
+        case GF_NOT_MODIFIED:
+            header = GF_STATUS_NOT_MODIFIED_MSG;
+            header_len = sizeof(GF_STATUS_NOT_MODIFIED_MSG) - 1;
             break;
         default:
             // Handle unknown status case
             return -1;
     }
 
-    total_bytes_sent = send((*ctx)->socket_fd, response, strlen(response), 0);
-    return total_bytes_sent;
+    return send((*ctx)->socket_fd, header, header_len, 0);
+}
+
+/*  Returns 1 if tag is the current version tag of path, as given by the
+    digest callback. Tags describe the content the callback checksummed,
+    so a file changed since then, which the callback no longer knows,
+    never matches and is sent in full. */
+static int tag_matches(gfcontext_t *ctx, const char *path, const char *tag) {
+    char current[GF_TAG_MAX];
+    size_t file_len;
+    uint32_t digest;
+
+    if (!ctx->digestfunc || ctx->digestfunc(path, &file_len, &digest) != 0) {
+        return 0;
+    }
+    snprintf(current, sizeof(current), GF_TAG_FORMAT, file_len, digest);
+    return strcmp(current, tag) == 0;
+}
+
+/*  Sends len bytes of fd from offset 0 to the socket, through sendfile where
+    the platform has it. Returns 0 once all of them are sent. */
+static int send_file(int socket_fd, int fd, size_t len) {
+#if defined(__linux__)
+    off_t offset = 0;
+
+    while (len > 0) {
+        ssize_t sent = sendfile(socket_fd, fd, &offset, len);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return -1; // the file shrank or the client went away
+        }
+        len -= sent;
+    }
+    return 0;
+#else
+    char buffer[GF_MGET_BUFSIZE];
+    off_t offset = 0;
+
+    while (len > 0) {
+        ssize_t got = pread(fd, buffer, len < sizeof(buffer) ? len : sizeof(buffer), offset);
+        if (got <= 0 || send(socket_fd, buffer, got, 0) != got) {
+            return -1;
+        }
+        offset += got;
+        len -= got;
+    }
+    return 0;
+#endif
+}
+
+/*  Receives an MGET request until the empty line that ends the path list,
+    starting from the first len bytes already in first. Returns a
+    NUL-terminated copy to free, or NULL if the request is too long or the
+    client went away. */
+static char *receive_mget(int socket_fd, const char *first, size_t len) {
+    char *request = malloc(GF_MGET_MAX_REQUEST + 1);
+    ssize_t got;
+
+    memcpy(request, first, len);
+    request[len] = '\0';
+    while (!strstr(request, GF_LINE_END)) {
+        if (len == GF_MGET_MAX_REQUEST) {
+            free(request);
+            return NULL;
+        }
+        got = recv(socket_fd, request + len, GF_MGET_MAX_REQUEST - len, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            free(request);
+            return NULL;
+        }
+        len += got;
+        request[len] = '\0';
+    }
+    return request;
+}
+
+/*  Holds back partial segments on the socket while on is set (Linux), so
+    many small writes leave as full segments once it is cleared. */
+static void set_cork(int socket_fd, int on) {
+#if defined(TCP_CORK)
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#endif
+}
+
+/*  Answers a batch request in one response: a record per path, each body
+    sent from the file with sendfile, while the socket is corked so the
+    small record headers and bodies are not sent a packet each. The
+    connection is closed afterwards; the client knows where the stream
+    ends from the record count, and a body cut short would leave every
+    later record out of step, so a failure closes it early. */
+static void serve_mget(gfcontext_t *ctx, int (*filefunc)(const char *), char *request) {
+    char *paths[GF_MGET_MAX_PATHS];
+    char record[GF_OK_HEADER_MAX];
+    char *cursor = request + sizeof(GF_MGET_REQUEST) - 1;
+    char *line;
+    size_t npaths = 0, i, file_len, digest_len, record_len;
+    uint32_t digest;
+    struct stat file_stat;
+    int fd;
+
+    // one path per line up to the empty line
+    while ((line = strstr(cursor, "\r\n")) && line != cursor) {
+        if (npaths == GF_MGET_MAX_PATHS || *cursor != '/') {
+            send(ctx->socket_fd, GF_STATUS_INVALID_MSG, strlen(GF_STATUS_INVALID_MSG), 0);
+            return;
+        }
+        *line = '\0';
+        paths[npaths++] = cursor;
+        cursor = line + 2;
+    }
+
+    set_cork(ctx->socket_fd, 1);
+    record_len = snprintf(record, sizeof(record), "GETFILE MGET %zu" GF_LINE_END, npaths);
+    if (gfs_send(&ctx, record, record_len) != record_len) {
+        gfs_abort(&ctx);
+        return;
+    }
+
+    for (i = 0; i < npaths; i++) {
+        fd = filefunc(paths[i]);
+        file_len = 0;
+        if (fd < 0) {
+            record_len = snprintf(record, sizeof(record), "FILE_NOT_FOUND 0\r\n");
+        } else if (fstat(fd, &file_stat) < 0) {
+            record_len = snprintf(record, sizeof(record), "ERROR 0\r\n");
+        } else {
+            file_len = file_stat.st_size;
+            if (ctx->digestfunc && ctx->digestfunc(paths[i], &digest_len, &digest) == 0 && digest_len == file_len) {
+                record_len = snprintf(record, sizeof(record), "OK %zu crc32c=%08x\r\n", file_len, digest);
+            } else {
+                record_len = snprintf(record, sizeof(record), "OK %zu\r\n", file_len);
+            }
+        }
+
+        if (gfs_send(&ctx, record, record_len) != record_len ||
+            (file_len > 0 && send_file(ctx->socket_fd, fd, file_len) < 0)) {
+            break;
+        }
+    }
+
+    set_cork(ctx->socket_fd, 0);
+    gfs_abort(&ctx);
+}
+
+/*  Returns 1 if token is one of the comma-separated encodings in list. */
+static int accepts_encoding(const char *list, const char *token) {
+    size_t len = strlen(token);
+
+    while (list) {
+        while (*list == ' ') {
+            list++;
+        }
+        if (strncmp(list, token, len) == 0 && (list[len] == '\0' || list[len] == ',' || list[len] == ' ')) {
+            return 1;
+        }
+        list = strchr(list, ',');
+        if (list) {
+            list++;
+        }
+    }
+    return 0;
+}
+
+/*  Answers a GET with the gzip variant of the file, announcing the length
+    and digest of the decoded file after the encoded length, and closes
+    the connection like a batch. Returns -1, having sent nothing, if the
+    file has no variant or no digest to announce. */
+static int serve_encoded(gfcontext_t *ctx, int (*encodingfunc)(const char *, const char *, size_t *), const char *path) {
+    char header[GF_ENCODED_HEADER_MAX];
+    size_t file_len, encoded_len, header_len;
+    uint32_t digest;
+    int fd;
+
+    if (!ctx->digestfunc || ctx->digestfunc(path, &file_len, &digest) != 0 ||
+        (fd = encodingfunc(path, GF_ENCODING_GZIP, &encoded_len)) < 0) {
+        return -1;
+    }
+
+    header_len = snprintf(header, sizeof(header),
+                          GF_STATUS_OK_MSG "%zu" GF_DIGEST_FIELD "%08x" GF_ENCODING_FIELD GF_ENCODING_GZIP GF_LENGTH_FIELD "%zu" GF_LINE_END,
+                          encoded_len, digest, file_len);
+    set_cork(ctx->socket_fd, 1);
+    if (gfs_send(&ctx, header, header_len) == header_len) {
+        send_file(ctx->socket_fd, fd, encoded_len);
+    }
+    set_cork(ctx->socket_fd, 0);
+    gfs_abort(&ctx);
+    return 0;
 }
 
 /* Define GetFile server data stucture. */
@@ -102,6 +365,9 @@ struct gfserver_t {
     // Callbacks
     gfh_error_t (*handler)(gfcontext_t **, const char *, void*); // server handler
     void* handlerarg; // handler arguments
+    int (*digestfunc)(const char *, size_t *, uint32_t *); // digest lookup for OK headers
+    int (*filefunc)(const char *); // descriptor lookup for batch requests, NULL if unset
+    int (*encodingfunc)(const char *, const char *, size_t *); // encoded variant lookup, NULL if unset
 };
 
 gfserver_t *gfserver_create(){
@@ -161,7 +427,7 @@ int validate_request(gfserver_t **gfs) {
     }
 
     // create new context wihtin the server
-    gfcontext_t *context = malloc(sizeof(gfcontext_t));
+    gfcontext_t *context = calloc(1, sizeof(gfcontext_t));
 
     // set client within context
     (*context).socket_fd = (*gfs)->client_socket;
@@ -241,7 +507,7 @@ void process_request(int client_socket_fd, gfserver_t *gfs) {
     if (strcmp(scheme, "GETFILE") != 0 || strcmp(method, "GET") != 0 || !path || strcmp(path, "/") != 0) {
         send(client_socket_fd, "GETFILE INVALID\r\n\r\n", 20, 0);
     } else {
-        gfcontext_t *context = malloc(sizeof(gfcontext_t));
+        gfcontext_t *context = calloc(1, sizeof(gfcontext_t));
         context->socket_fd = client_socket_fd;
         gfs->handler(&context, path, gfs->handlerarg);
     }
@@ -330,13 +596,14 @@ void gfserver_serve(gfserver_t **gfs){
         }
 
         // new context 
-        gfcontext_t *context = malloc(sizeof(gfcontext_t)); // Allocate context outside the loop
+        gfcontext_t *context = calloc(1, sizeof(gfcontext_t)); // Allocate context outside the loop
         if (!context) {
             perror("fail to allocate memory for context");
             exit(1);
         }
 
         context->socket_fd = client_socket;
+        context->digestfunc = (*gfs)->digestfunc;
 
         // process the request, continue listening for more requests
         while (true) {
@@ -348,18 +615,60 @@ void gfserver_serve(gfserver_t **gfs){
                 break;
             }
 
-            // request form: <scheme> <method> <path>\r\n\r\n
+            // batch form: GETFILE MGET\r\n<path>\r\n...\r\n\r\n
+            if (strncmp(buffer, GF_MGET_REQUEST, sizeof(GF_MGET_REQUEST) - 1) == 0) {
+                char *request;
+                if (!(*gfs)->filefunc) {
+                    send(client_socket, GF_STATUS_ERROR_MSG, strlen(GF_STATUS_ERROR_MSG), 0);
+                } else if ((request = receive_mget(client_socket, buffer, bytes_received))) {
+                    serve_mget(context, (*gfs)->filefunc, request);
+                    free(request);
+                } else {
+                    send(client_socket, GF_STATUS_INVALID_MSG, strlen(GF_STATUS_INVALID_MSG), 0);
+                }
+                break;
+            }
+
+            // request form: <scheme> <method> <path>[ IF-NONE-MATCH <tag>][ ACCEPT-ENCODING <tokens>]\r\n\r\n
             char *scheme = strtok(buffer," ");
             char *method = strtok(NULL," ");
             char *path = strtok(NULL, GF_LINE_END);
+            char *encodings = path ? strstr(path, GF_ACCEPT_ENCODING) : NULL;
+            if (encodings) {
+                *encodings = '\0';
+                encodings += sizeof(GF_ACCEPT_ENCODING) - 1;
+            }
+            char *tag = path ? strstr(path, GF_IF_NONE_MATCH) : NULL;
+            if (tag) {
+                *tag = '\0';
+                tag += sizeof(GF_IF_NONE_MATCH) - 1;
+            }
 
             // checking possible errors that invalidate the request 
-            if(strcmp(scheme, "GETFILE") != 0 || strcmp(method, "GET") != 0 || (path != NULL && strcmp(path, "/") != 0)){
+            if(scheme == NULL || method == NULL || path == NULL || strcmp(scheme, "GETFILE") != 0 || strcmp(method, "GET") != 0 || path[0] != '/'){
                 send(client_socket, GF_STATUS_INVALID_MSG, strlen(GF_STATUS_INVALID_MSG), 0);
                 break;
             }
 
             
+            // the context keeps its own copy, so a handler that takes the
+            // context can go on using the path after this buffer is reused
+            snprintf(context->path, sizeof(context->path), "%s", path);
+            path = context->path;
+
+            // the client's copy is current: answer without touching the file
+            if (tag && tag_matches(context, path, tag)) {
+                gfs_sendheader(&context, GF_NOT_MODIFIED, 0);
+                break;
+            }
+
+            // files without a variant, and clients that cannot decode it, get the raw bytes
+            if (encodings && (*gfs)->encodingfunc && accepts_encoding(encodings, GF_ENCODING_GZIP) &&
+                serve_encoded(context, (*gfs)->encodingfunc, path) == 0) {
+                break;
+            }
+
+            // a handler that sets the context to NULL has taken it, see gfs_finish
             (*gfs)->handler(&context, path, (*gfs)->handlerarg);
             
             break;
@@ -377,6 +686,18 @@ void gfserver_set_handler(gfserver_t **gfs, gfh_error_t (*handler)(gfcontext_t *
     (*gfs)->handler = handler;
 }
 
+void gfserver_set_digestfunc(gfserver_t **gfs, int (*digestfunc)(const char *, size_t *, uint32_t *)){
+    (*gfs)->digestfunc = digestfunc;
+}
+
+void gfserver_set_filefunc(gfserver_t **gfs, int (*filefunc)(const char *)){
+    (*gfs)->filefunc = filefunc;
+}
+
+void gfserver_set_encodingfunc(gfserver_t **gfs, int (*encodingfunc)(const char *, const char *, size_t *)){
+    (*gfs)->encodingfunc = encodingfunc;
+}
+
 void gfserver_set_maxpending(gfserver_t **gfs, int max_npending){
     (*gfs)->max_npending = max_npending;
 }
@@ -2,6 +2,7 @@
 #define __GF_SERVER_H__
 
 #include <unistd.h>
+#include <stdint.h>
 
 /*
  * gfserver is a server library for transferring files using the GETFILE
@@ -12,6 +13,7 @@ typedef int gfstatus_t;
 
 #define  GF_OK 200
 #define  GF_FILE_NOT_FOUND 400
+#define  GF_NOT_MODIFIED 304
 #define  GF_ERROR 500
 #define  GF_INVALID 600
 
@@ -45,6 +47,9 @@ void gfserver_serve(gfserver_t **gfs);
  * 	 it calls as it handles the response.
  * - the requested path
  * - the pointer specified in the gfserver_set_handlerarg option.
+ * The handler may also take the context to answer later, e.g. from a
+ * worker thread, by setting *ctx to NULL; it then ends the response with
+ * gfs_finish.  The path stays valid as long as the context does.
  */
 void gfserver_set_handler(gfserver_t **gfs, gfh_error_t (*handler)(gfcontext_t **, const char *, void*));
 
@@ -59,6 +64,43 @@ void gfserver_set_maxpending(gfserver_t **gfs, int max_npending);
  */
 void gfserver_set_handlerarg(gfserver_t **gfs, void* arg);
 
+/*
+ * Sets the callback that gives the length and CRC32C of the file at a
+ * requested path.  It returns 0 when it knows the path, and OK headers
+ * then carry the digest as "GETFILE OK <length> crc32c=<8 hex digits>"
+ * so the client can verify the body.  Without it (the default), or when
+ * it returns nonzero, OK headers carry the length only.
+ *
+ * The same lookup answers conditional requests: a GET with
+ * IF-NONE-MATCH and the path's current version tag is answered with
+ * NOT_MODIFIED without calling the handler.  Any other tag, or a path
+ * the callback does not know, goes to the handler as usual.  The callback
+ * must fail for a file that changed since it was checksummed, or a stale
+ * copy would be confirmed as current.
+ */
+void gfserver_set_digestfunc(gfserver_t **gfs, int (*digestfunc)(const char *path, size_t *file_len, uint32_t *digest));
+
+/*
+ * Sets the callback that gives an open descriptor for the file at a
+ * requested path, or -1 if there is none.  It enables batch (MGET)
+ * requests, which the library answers itself without the handler,
+ * sending each file from the descriptor with sendfile.  The descriptor
+ * stays owned by the callback and is read at explicit offsets, so it
+ * may be shared.  Without it (the default) MGET is answered with ERROR.
+ */
+void gfserver_set_filefunc(gfserver_t **gfs, int (*filefunc)(const char *path));
+
+/*
+ * Sets the callback that gives an open descriptor for an encoded variant
+ * of the file at a requested path, and its length in encoded_len, or -1
+ * if there is none.  A GET whose ACCEPT-ENCODING list names gzip is then
+ * answered with the gzip variant when the callback has one and the
+ * digest callback knows the file, without calling the handler.  Other
+ * requests, and files without a variant, go to the handler as usual.
+ * The descriptor stays owned by the callback, as with the file callback.
+ */
+void gfserver_set_encodingfunc(gfserver_t **gfs, int (*encodingfunc)(const char *path, const char *encoding, size_t *encoded_len));
+
 /*
  * Sends to the client the Getfile header containing the appropriate
  * status and file length for the given inputs.  This function should
@@ -85,4 +127,10 @@ gfh_error_t gfs_handler(gfcontext_t **ctx, const char *path, void* arg);
  */
 void gfs_abort(gfcontext_t **ctx);
 
+/*
+ * Ends the response of a context the handler took: closes the connection
+ * to the client, frees the context and sets *ctx to NULL.
+ */
+void gfs_finish(gfcontext_t **ctx);
+
 #endif
@@ -20,13 +20,15 @@
   "options:\n"                                                                                 \
   "  -h          		Show this help message.\n"              		                       \
   "  -m [content_file]  Content file mapping keys to content filea (Default: 'content.txt')\n" \
-  "  -p [listen_port]   Listen port (Default: 47293)\n"
+  "  -p [listen_port]   Listen port (Default: 47293)\n"                                        \
+  "  -z                 Build gzip variants of requested files in the background\n"
 
 /* OPTIONS DESCRIPTOR ====================================================== */
 static struct option gLongOptions[] = {
     {"help", no_argument, NULL, 'h'},
     {"content", required_argument, NULL, 'm'},
     {"port", required_argument, NULL, 'p'},
+    {"gzip", no_argument, NULL, 'z'},
     {NULL, 0, NULL, 0}};
 
 /* Main ========================================================= */
@@ -35,12 +37,13 @@ int main(int argc, char **argv) {
   char *content_map_file = "content.txt";
   unsigned short port = 47293;
   int option_char = 0;
+  int gzip = 0;
 
 
   setbuf(stdout, NULL);  // disable caching of standpard output
 
   // Parse and set command line arguments
-  while ((option_char = getopt_long(argc, argv, "hal:p:m:", gLongOptions, NULL)) != -1) {
+  while ((option_char = getopt_long(argc, argv, "hal:p:m:z", gLongOptions, NULL)) != -1) {
     switch (option_char) {
 
       case 'p':  /* listen-port */
@@ -49,6 +52,9 @@ int main(int argc, char **argv) {
       case 'm':  /* file-path */
         content_map_file = optarg;
         break;
+      case 'z':  /* gzip */
+        gzip = 1;
+        break;
       case 'h':  /* help */
         fprintf(stdout, "%s", USAGE);
         exit(0);
@@ -60,6 +66,10 @@ int main(int argc, char **argv) {
   }
 
   content_init(content_map_file);
+  if (gzip && 0 > content_gzip_start()) {
+    fprintf(stderr, "Unable to start the gzip thread\n");
+    exit(EXIT_FAILURE);
+  }
 
   if (port > 65331) {
     fprintf(stderr, "Invalid port number\n");
@@ -71,6 +81,9 @@ int main(int argc, char **argv) {
 
   /*Setting options*/
   gfserver_set_handler(&gfs, gfs_handler);
+  gfserver_set_digestfunc(&gfs, content_digest);
+  gfserver_set_filefunc(&gfs, content_get);
+  gfserver_set_encodingfunc(&gfs, content_encoded);
   gfserver_set_port(&gfs, port);
   gfserver_set_maxpending(&gfs, 25);
 
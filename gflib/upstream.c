@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gfclient.h"
+#include "upstream.h"
+
+static const char *server = "localhost";
+static unsigned short port = 47293;
+
+typedef struct {
+  upstream_headerfunc_t headerfunc;
+  void *arg;
+} fetch_t;
+
+void upstream_init(const char *upstream_server, unsigned short upstream_port) {
+  server = upstream_server;
+  port = upstream_port;
+  gfc_global_init();
+}
+
+/* Translates the raw header of the response for the caller. */
+static void headercb(void *header, size_t header_len, void *arg) {
+  fetch_t *fetch = (fetch_t *)arg;
+  char text[128], status[16] = "";
+  size_t file_len = 0;
+  unsigned int digest = 0;
+  int has_digest;
+
+  /* The header is not NUL-terminated */
+  if (header_len >= sizeof(text))
+    header_len = sizeof(text) - 1;
+  memcpy(text, header, header_len);
+  text[header_len] = '\0';
+
+  if (2 == sscanf(text, "GETFILE %15s %zu", status, &file_len) && 0 == strcmp(status, "OK")) {
+    has_digest = 1 == sscanf(text, "GETFILE OK %*u crc32c=%8x", &digest);
+    fetch->headerfunc(UPSTREAM_OK, file_len, has_digest, digest, fetch->arg);
+  } else if (0 == strcmp(status, "FILE_NOT_FOUND")) {
+    fetch->headerfunc(UPSTREAM_FILE_NOT_FOUND, 0, 0, 0, fetch->arg);
+  } else {
+    fetch->headerfunc(UPSTREAM_ERROR, 0, 0, 0, fetch->arg);
+  }
+}
+
+int upstream_fetch(const char *path, upstream_headerfunc_t headerfunc, void (*writefunc)(void *, size_t, void *), void *arg) {
+  fetch_t fetch = {headerfunc, arg};
+  gfcrequest_t *gfr = gfc_create();
+  int returncode;
+
+  gfc_set_server(&gfr, server);
+  gfc_set_port(&gfr, port);
+  gfc_set_path(&gfr, path);
+  gfc_set_headerfunc(&gfr, headercb);
+  gfc_set_headerarg(&gfr, &fetch);
+  gfc_set_writefunc(&gfr, writefunc);
+  gfc_set_writearg(&gfr, arg);
+
+  returncode = gfc_perform(&gfr);
+  if (0 == returncode && GF_OK == gfc_get_status(&gfr) && gfc_get_bytesreceived(&gfr) != gfc_get_filelen(&gfr))
+    returncode = -1;
+
+  gfc_cleanup(&gfr);
+  return returncode;
+}
@@ -0,0 +1,41 @@
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fetches files from an upstream gfserver for gfproxy.  The client and
+ * server headers of gflib cannot be included together, so the proxy
+ * reaches gfc_perform through this module.
+ */
+
+/* Status of an upstream response */
+typedef enum {
+  UPSTREAM_OK,
+  UPSTREAM_FILE_NOT_FOUND,
+  UPSTREAM_ERROR
+} upstream_status_t;
+
+/*
+ * Called once per fetch, before any byte of the body, with the status,
+ * the length of the file and its CRC32C if the upstream announced one.
+ */
+typedef void (*upstream_headerfunc_t)(upstream_status_t status, size_t file_len, int has_digest, uint32_t digest, void *arg);
+
+/*
+ * Sets the address and port of the upstream server and initializes the
+ * client library.  Called once, before any fetch.
+ */
+void upstream_init(const char *server, unsigned short port);
+
+/*
+ * Fetches path from the upstream server, handing its header to headerfunc
+ * and each chunk of its body to writefunc as it arrives.  headerfunc is
+ * not called if the upstream cannot be reached or answers with an invalid
+ * header.  Returns 0 once the whole body arrived and matched its digest,
+ * or the upstream answered with another status, and -1 otherwise.
+ */
+int upstream_fetch(const char *path, upstream_headerfunc_t headerfunc, void (*writefunc)(void *data, size_t len, void *arg), void *arg);
+
+#endif
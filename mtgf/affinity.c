@@ -0,0 +1,61 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "affinity.h"
+
+#if defined(__linux__)
+/* The CPUs the process may run on, read once before any thread is pinned */
+static cpu_set_t allowed;
+static int nallowed;
+static pthread_once_t allowed_once = PTHREAD_ONCE_INIT;
+
+static void _allowedinit(){
+	long ncpus;
+
+	if(0 == sched_getaffinity(0, sizeof(allowed), &allowed))
+		nallowed = CPU_COUNT(&allowed);
+	if(nallowed < 1){
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		CPU_ZERO(&allowed);
+		for(nallowed = 0; nallowed < ncpus && nallowed < CPU_SETSIZE; nallowed++)
+			CPU_SET(nallowed, &allowed);
+	}
+}
+#endif
+
+int affinity_ncpus(){
+#if defined(__linux__)
+	pthread_once(&allowed_once, _allowedinit);
+	return nallowed > 0 ? nallowed : 1;
+#else
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return ncpus > 0 ? (int) ncpus : 1;
+#endif
+}
+
+int affinity_pin(int slot){
+#if defined(__linux__)
+	cpu_set_t cpuset;
+	int n, cpu;
+
+	/* The (slot % n)-th CPU of the allowed set */
+	n = slot % affinity_ncpus();
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if(CPU_ISSET(cpu, &allowed) && 0 == n--)
+			break;
+	if(CPU_SETSIZE == cpu)
+		return EINVAL;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+#else
+	(void) slot;
+	return 0;
+#endif
+}
@@ -0,0 +1,19 @@
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+/*
+ * Returns the number of CPUs the process may run on, which honours
+ * taskset and cgroup cpusets, or 1 if it cannot be determined.
+ */
+int affinity_ncpus();
+
+/*
+ * Pins the calling thread to the (slot % affinity_ncpus())-th CPU the
+ * process may run on.  Memory the thread touches for the first time after
+ * this call (its stack and any buffers it allocates) is then placed on
+ * that CPU's NUMA node by the kernel's first-touch policy.  Returns 0 on success, or if pinning is
+ * not supported on this platform, and an error number otherwise.
+ */
+int affinity_pin(int slot);
+
+#endif
@@ -0,0 +1,45 @@
+#include "bloom.h"
+
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_PROBES 7	/* optimal for 10 bits per key */
+
+/* 64-bit FNV-1a; the two halves seed double hashing */
+static uint64_t _hash(const char *key){
+	uint64_t h = 14695981039346656037ULL;
+
+	while('\0' != *key){
+		h ^= (unsigned char) *key++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+size_t bloom_words(size_t nkeys){
+	size_t nwords = 1;
+
+	while(nwords * 64 < nkeys * BLOOM_BITS_PER_KEY)
+		nwords <<= 1;
+	return nwords;
+}
+
+void bloom_add(uint64_t *bits, size_t nwords, const char *key){
+	uint64_t h = _hash(key);
+	uint64_t mask = nwords * 64 - 1;
+	uint32_t h1 = h, h2 = (h >> 32) | 1;
+	int i;
+
+	for(i = 0; i < BLOOM_PROBES; i++, h1 += h2)
+		bits[(h1 & mask) >> 6] |= 1ULL << (h1 & 63);
+}
+
+int bloom_test(const uint64_t *bits, size_t nwords, const char *key){
+	uint64_t h = _hash(key);
+	uint64_t mask = nwords * 64 - 1;
+	uint32_t h1 = h, h2 = (h >> 32) | 1;
+	int i;
+
+	for(i = 0; i < BLOOM_PROBES; i++, h1 += h2)
+		if(0 == (bits[(h1 & mask) >> 6] & (1ULL << (h1 & 63))))
+			return 0;
+	return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef __BLOOM_H__
+#define __BLOOM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A Bloom filter over string keys, stored as a plain array of words so
+ * it can live in malloc'd memory or inside a mapped content index.
+ */
+
+/*
+ * Returns the number of 64-bit words to allocate, zeroed, for a filter
+ * holding nkeys keys with a false positive rate of about 1%.  Always a
+ * power of two.
+ */
+size_t bloom_words(size_t nkeys);
+
+/*
+ * Adds key to the filter.
+ */
+void bloom_add(uint64_t *bits, size_t nwords, const char *key);
+
+/*
+ * Returns 0 if key was never added, 1 if it may have been.
+ */
+int bloom_test(const uint64_t *bits, size_t nwords, const char *key);
+
+#endif
@@ -5,90 +5,1026 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
 
-#define MAX_KEYLEN 512
+#include "content.h"
+#include "content_index.h"
+#include "bloom.h"
+#include "latency.h"
 
-typedef struct{
-	int fildes;
-	char key[MAX_KEYLEN];
-} item_t;
+#define FILDES_CLOSED -1	/* not opened yet */
+#define FILDES_MISSING -2	/* open failed and was reported; tried again on the next hold */
+
+typedef struct content_entry_t item_t;
+
+struct content_entry_t{
+	int fildes;	/* open descriptor, FILDES_CLOSED or FILDES_MISSING */
+	int users;	/* requests currently using fildes */
+	int stale;	/* fildes is a file since replaced; closed once users drops to 0 */
+	item_t *prev;	/* idle open descriptors, in the LRU list */
+	item_t *next;
+	content_map_t *map;
+	int watch;	/* inotify watch of the file's directory, -1 if not watched */
+	off_t size;	/* -1 until first opened, updated by the watcher, atomic */
+	off_t offset;	/* where the file's bytes start in fildes: 0, or its place in a pack */
+	const char *key;	/* both point into the mapped content file */
+	const char *path;
+};
+
+struct content_map_t{
+	int nitems;
+	item_t *items;	/* for an index, zeroed until each is first found */
+	int refs;	/* one while current, plus one per reader */
+	char *text;	/* private mapping of the content file, or the index */
+	size_t textlen;
+	char *tail;	/* copy of a last line without a newline */
+	const content_index_entry_t *index;	/* shared mapping of a compiled index */
+	const char *arena;
+	const uint64_t *bloom;	/* rejects most unknown keys before the search */
+	size_t bloomwords;
+	int packfd;	/* descriptor of a pack holding every file, -1 if files are separate */
+	int *watches;	/* one inotify watch per directory of content files, sorted */
+	int nwatches;
+	int *byname;	/* chains of watched items hashed by watch and file name, -1 terminated */
+	int *nextname;	/* next item in the same chain, per item */
+	size_t nbyname;	/* a power of two */
+};
+
+/* Items of an index map are set up on first lookup; map is set last */
+#define ITEM_READY(item) (NULL != __atomic_load_n(&(item)->map, __ATOMIC_ACQUIRE))
+
+/* Items of a pack share the map's descriptor and stay out of the descriptor cache */
+#define ITEM_PACKED(item) (0 <= (item)->map->packfd)
+
+/* The map new lookups go to; swapped by content_reload */
+static content_map_t *current;
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *mapfile;
+static content_map_t *(*mapload)(const char *filename);
 
-static int nitems;
-static item_t *items;
+/*
+ * Descriptor cache shared by all maps. Open descriptors nobody is using
+ * sit in an LRU list and are closed, least recently used first, once
+ * more than max_fds are open. Descriptors in use are never closed, so
+ * the limit may be exceeded while every open file is being served.
+ */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static item_t *lru_head;	/* most recently used */
+static item_t *lru_tail;
+static int open_fds;
+static int max_fds;
+
+static void _lruremove(item_t *item){
+	if(item->prev) item->prev->next = item->next;
+	else lru_head = item->next;
+	if(item->next) item->next->prev = item->prev;
+	else lru_tail = item->prev;
+	item->prev = item->next = NULL;
+}
+
+static void _lrupush(item_t *item){
+	item->prev = NULL;
+	item->next = lru_head;
+	if(lru_head) lru_head->prev = item;
+	else lru_tail = item;
+	lru_head = item;
+}
+
+static void _lruevict(){
+	item_t *victim;
+
+	while(open_fds > max_fds && NULL != (victim = lru_tail)){
+		_lruremove(victim);
+		close(victim->fildes);
+		victim->fildes = FILDES_CLOSED;
+		open_fds--;
+	}
+}
 
 static int _itemcmp(const void *a, const void *b){
 	return strcmp(((item_t*) a)->key,((item_t*) b)->key);
 }
 
-int content_init(const char *filename){
-	FILE *filelist;
+static void _mapfree(content_map_t *map){
+	int i;
+
+	/* No entry is in use once the last map reference is gone */
+	pthread_mutex_lock(&cache_lock);
+	for(i = 0; i < map->nitems; i++)
+		if(ITEM_READY(&map->items[i]) && !ITEM_PACKED(&map->items[i]) && 0 <= map->items[i].fildes){
+			_lruremove(&map->items[i]);
+			close(map->items[i].fildes);
+			open_fds--;
+		}
+	pthread_mutex_unlock(&cache_lock);
+
+	if(0 <= map->packfd)
+		close(map->packfd);
+
+	if(map->textlen > 0)
+		munmap(map->text, map->textlen);
+	free(map->tail);
+	free(map->watches);
+	free(map->byname);
+	free(map->nextname);
+	if(NULL == map->index)
+		free((void*) map->bloom);
+	free(map->items);
+	free(map);
+}
+
+/* Splits one "key path" line in place and appends it to the map */
+static void _mapline(content_map_t *map, char *line, int *capacity){
+	char *ptr = line;
+	char *key, *path;
+	item_t *item;
+
+	/* Using space delimiter to sep key and path*/
+	key = strsep(&ptr, " \t"); 		/* The key is first */
+	path = strsep(&ptr, " \t"); /* The path second */
+	if(NULL == path || '\0' == *key || '\0' == *path){
+		if('\0' != *line)
+			fprintf(stderr, "Skipping malformed content line %s.\n", line);
+		return;
+	}
+
+	if(map->nitems == *capacity){
+		*capacity *= 2;
+		map->items = realloc(map->items, *capacity * sizeof(item_t));
+	}
+
+	item = &map->items[map->nitems++];
+	memset(item, 0, sizeof(item_t));
+	item->fildes = FILDES_CLOSED;
+	item->watch = -1;
+	item->size = -1;
+	item->key = key;
+	item->path = path;
+}
+
+/*
+ * Builds a new map from filename, or returns NULL if it cannot be read.
+ * The file is mapped privately and split in place, so keys and paths are
+ * not copied, and only the compact item array is sorted. Files are not
+ * opened here but on first lookup, so a missing file is reported and
+ * answered as not found instead of failing the whole map.
+ */
+static content_map_t *_mapload(const char *filename){
 	int capacity = 16;
-	char *path, *ptr;
+	content_map_t *map;
+	struct stat st;
+	char *line, *end, *eol;
+	uint64_t *bloom;
+	int fd;
 
-	if( NULL == (filelist = fopen(filename, "r"))){
-		fprintf(stderr, "Unable to open file in content_init.\n");
-		exit(EXIT_FAILURE);
+	if( 0 > (fd = open(filename, O_RDONLY)) || 0 > fstat(fd, &st)){
+		fprintf(stderr, "Unable to open content map %s.\n", filename);
+		if(0 <= fd)
+			close(fd);
+		return NULL;
+	}
+
+	map = (content_map_t*) calloc(1, sizeof(content_map_t));
+	map->refs = 1;
+	map->packfd = -1;
+	map->items = (item_t*) malloc(capacity * sizeof(item_t));
+	map->textlen = st.st_size;
+	if(map->textlen > 0){
+		map->text = mmap(NULL, map->textlen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if(MAP_FAILED == map->text){
+			fprintf(stderr, "Unable to map content map %s.\n", filename);
+			close(fd);
+			map->textlen = 0;
+			_mapfree(map);
+			return NULL;
+		}
+	}
+	close(fd);
+
+	end = map->text + map->textlen;
+	for(line = map->text; line < end; line = eol + 1){
+		if(NULL == (eol = memchr(line, '\n', end - line))){
+			/* No room to terminate the last line inside the mapping */
+			map->tail = strndup(line, end - line);
+			_mapline(map, map->tail, &capacity);
+			break;
+		}
+		/*Taking out EOL characters*/
+		*eol = '\0';
+		if(eol > line && '\r' == eol[-1])
+			eol[-1] = '\0';
+		_mapline(map, line, &capacity);
+	}
+
+	qsort(map->items, map->nitems, sizeof(item_t), _itemcmp);
+
+	map->bloomwords = bloom_words(map->nitems);
+	bloom = (uint64_t*) calloc(map->bloomwords, sizeof(uint64_t));
+	for(int i = 0; i < map->nitems; i++){
+		map->items[i].map = map;
+		bloom_add(bloom, map->bloomwords, map->items[i].key);
+	}
+	map->bloom = bloom;
+
+	return map;
+}
+
+/*
+ * Maps an index compiled by content_index, or returns NULL if it cannot
+ * be read. Nothing is parsed or sorted: the file is mapped shared and
+ * read-only, so its pages are shared by every server mapping it, and the
+ * per-key state is zeroed memory that is only touched for keys that are
+ * actually requested (see _itemfind). A pack keeps its descriptor open
+ * for the map's lifetime; every key is read through it.
+ */
+static content_map_t *_indexload(const char *filename){
+	const content_index_header_t *header;
+	const content_index_entry_t *index;
+	content_map_t *map;
+	struct stat st;
+	void *base;
+	int fd;
+
+	if( 0 > (fd = open(filename, O_RDONLY)) || 0 > fstat(fd, &st)){
+		fprintf(stderr, "Unable to open content index %s.\n", filename);
+		if(0 <= fd)
+			close(fd);
+		return NULL;
+	}
+
+	base = MAP_FAILED;
+	if((size_t) st.st_size >= sizeof(content_index_header_t))
+		base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(MAP_FAILED == base){
+		fprintf(stderr, "Unable to map content index %s.\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	/* Only the header is checked; entries are trusted to come from content_index */
+	header = (const content_index_header_t*) base;
+	index = (const content_index_entry_t*) (header + 1);
+	if(0 != memcmp(header->magic, CONTENT_INDEX_MAGIC, sizeof(header->magic)) ||
+			header->bloomwords != bloom_words(header->nitems) ||
+			header->arena != sizeof(*header) + (uint64_t) header->nitems * sizeof(*index) +
+				header->bloomwords * sizeof(uint64_t) ||
+			(0 == header->data ? header->arena + header->arenalen != (uint64_t) st.st_size :
+				header->data < header->arena + header->arenalen || header->data > (uint64_t) st.st_size)){
+		fprintf(stderr, "Content index %s is not valid.\n", filename);
+		munmap(base, st.st_size);
+		close(fd);
+		return NULL;
+	}
+	if(0 == header->data){
+		close(fd);
+		fd = -1;
 	}
 
-	items = (item_t*) malloc(capacity * sizeof(item_t));
-	nitems = 0;
-	while(fgets(items[nitems].key, MAX_KEYLEN, filelist)){
-		/*Taking out EOL character*/
-		items[nitems].key[strlen(items[nitems].key)-1] = '\0';
+	map = (content_map_t*) calloc(1, sizeof(content_map_t));
+	map->refs = 1;
+	map->nitems = header->nitems;
+	map->items = (item_t*) calloc(map->nitems ? map->nitems : 1, sizeof(item_t));
+	map->index = index;
+	map->arena = (const char*) base + header->arena;
+	map->bloom = (const uint64_t*) (index + map->nitems);
+	map->bloomwords = header->bloomwords;
+	map->text = base;
+	map->textlen = st.st_size;
+	map->packfd = fd;
+
+	return map;
+}
 
-		/* Using space delimiter to sep key and path*/
-		ptr = items[nitems].key;
-		strsep(&ptr, " \t"); 		/* The key is first */
-		path = strsep(&ptr, " \t"); /* The path second */
+/*
+ * Returns the item's descriptor marked as in use, opening it through the
+ * cache on a miss. The open itself happens outside the cache lock; if
+ * another thread opened the same file meanwhile, its descriptor wins.
+ * Returns -1 if the file cannot be opened.
+ */
+static int _itemhold(item_t *item){
+	struct stat st;
+	int fildes, seen;
 
-		if( 0 > (items[nitems].fildes = open(path, O_RDONLY))){
-			fprintf(stderr, "Unable to open file %s.\n", path);
-			exit(EXIT_FAILURE);
+	/* Open for as long as the map, which the caller holds */
+	if(ITEM_PACKED(item))
+		return 0 <= item->fildes ? item->fildes : -1;
+
+	/* A missing file is tried again, so one created after the map loaded is served */
+	pthread_mutex_lock(&cache_lock);
+	if(FILDES_CLOSED == (seen = item->fildes) || FILDES_MISSING == seen){
+		pthread_mutex_unlock(&cache_lock);
+
+		if( 0 <= (fildes = open(item->path, O_RDONLY)) && 0 > fstat(fildes, &st)){
+			close(fildes);
+			fildes = -1;
 		}
-		nitems++;
 
-		if(nitems == capacity){
-			capacity *= 2;
-			items = realloc(items, capacity * sizeof(item_t));
+		pthread_mutex_lock(&cache_lock);
+		if(seen == item->fildes){
+			if(0 > fildes){
+				item->fildes = FILDES_MISSING;
+				pthread_mutex_unlock(&cache_lock);
+				if(FILDES_CLOSED == seen)
+					fprintf(stderr, "Unable to open file %s.\n", item->path);
+				return -1;
+			}
+			/* Idle until taken below, like any other open descriptor */
+			item->fildes = fildes;
+			__atomic_store_n(&item->size, st.st_size, __ATOMIC_RELAXED);
+			_lrupush(item);
+			open_fds++;
+		}else if(0 <= fildes){
+			close(fildes);
 		}
+	}
 
+	if(0 > (fildes = item->fildes)){
+		pthread_mutex_unlock(&cache_lock);
+		return -1;
 	}
+	/* An open descriptor nobody uses is in the LRU list, where it may be evicted */
+	if(0 == item->users)
+		_lruremove(item);
+	item->users++;
+	_lruevict();
+	pthread_mutex_unlock(&cache_lock);
 
-	fclose(filelist);
+	return fildes;
+}
 
-	qsort(items, nitems, sizeof(item_t), _itemcmp);
+/* Marks the item's descriptor as no longer used by the caller */
+static void _itemput(item_t *item){
+	if(ITEM_PACKED(item))
+		return;
 
+	pthread_mutex_lock(&cache_lock);
+	if(0 == --item->users){
+		if(item->stale){
+			/* The next hold opens the file now at the path */
+			close(item->fildes);
+			item->fildes = FILDES_CLOSED;
+			item->stale = 0;
+			open_fds--;
+		}else{
+			_lrupush(item);
+			_lruevict();
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void content_set_maxfds(int n){
+	pthread_mutex_lock(&cache_lock);
+	max_fds = n;
+	_lruevict();
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static int _init(const char *filename, content_map_t *(*loader)(const char *filename)){
+	struct rlimit limit;
+
+	mapload = loader;
+	if( NULL == (current = mapload(filename)))
+		exit(EXIT_FAILURE);
+
+	/* Leave half of the descriptor limit for sockets and everything else */
+	if(0 == max_fds){
+		max_fds = 1024;
+		if(0 == getrlimit(RLIMIT_NOFILE, &limit) && RLIM_INFINITY != limit.rlim_cur)
+			max_fds = limit.rlim_cur / 2;
+		if(max_fds < 16)
+			max_fds = 16;
+	}
+
+	mapfile = strdup(filename);
 	return EXIT_SUCCESS;
 }
 
+int content_init(const char *filename){
+	return _init(filename, _mapload);
+}
+
+int content_init_binary(const char *filename){
+	return _init(filename, _indexload);
+}
+
+content_map_t *content_acquire(){
+	content_map_t *map;
+
+	pthread_mutex_lock(&current_lock);
+	map = current;
+	__atomic_add_fetch(&map->refs, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&current_lock);
+
+	return map;
+}
+
+void content_release(content_map_t *map){
+	/* The last reader of a replaced map closes its descriptors */
+	if(NULL != map && 0 == __atomic_sub_fetch(&map->refs, 1, __ATOMIC_ACQ_REL))
+		_mapfree(map);
+}
+
 unsigned long int content_delay = 0;
 
-int content_get(const char *key){
+/* When set, lookups never sleep: the caller delays requests on its own */
+int content_delay_async = 0;
+
+/* Sets up the item of an index map the first time its key is found */
+static item_t *_indexitem(content_map_t *map, int i){
+	item_t *item = &map->items[i];
+
+	if(ITEM_READY(item))
+		return item;
+
+	pthread_mutex_lock(&cache_lock);
+	if(NULL == item->map){
+		item->fildes = FILDES_CLOSED;
+		if(0 <= map->packfd){
+			item->fildes = 0 <= map->index[i].size ? map->packfd : FILDES_MISSING;
+			item->offset = ((const content_index_header_t*) map->text)->data + map->index[i].offset;
+		}
+		item->watch = -1;
+		item->size = map->index[i].size;
+		item->key = map->arena + map->index[i].key;
+		item->path = map->arena + map->index[i].path;
+		__atomic_store_n(&item->map, map, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return item;
+}
+
+static item_t *_itemfind(content_map_t *map, const char *key){
 	int lo = 0;
-	int hi = nitems - 1;
+	int hi = map->nitems - 1;
 	int mid, cmp;
 
-	if (content_delay > 0) {
-		usleep(content_delay);
-	}
+	/* Most requests for unknown keys stop here, after a few probes */
+	if (!bloom_test(map->bloom, map->bloomwords, key))
+		return NULL;
 
 	while (lo <= hi) {
 		// Key is in items[lo..hi] or not present.
 		mid = lo + (hi - lo) / 2;
-		cmp = strcmp(key,items[mid].key);
+		if (NULL != map->index)
+			cmp = strcmp(key,map->arena + map->index[mid].key);
+		else
+			cmp = strcmp(key,map->items[mid].key);
 		if ( cmp < 0) hi = mid - 1;
 		else if (cmp > 0) lo = mid + 1;
+		else if (NULL != map->index){
+			return _indexitem(map, mid);
+		}
 		else{
-			return items[mid].fildes;
-		} 
+			return &map->items[mid];
+		}
+	}
+	return NULL;
+}
+
+int content_get(const char *key){
+	content_entry_t *entry;
+	size_t size;
+	int fildes;
+
+	/* Without holding the entry, the cache may close the descriptor at any time */
+	fildes = content_open(key, &size, &entry);
+	if (NULL != entry && ITEM_PACKED(entry))
+		fildes = -1;	/* the file does not start at offset 0 of the pack */
+	content_close(entry);
+	return fildes;
+}
+
+int content_open(const char *key, size_t *size, content_entry_t **entry){
+	content_map_t *map;
+	unsigned long delay;
+	item_t *item;
+	int fildes;
+
+	map = content_acquire();
+	if (NULL == (item = _itemfind(map, key))){
+		content_release(map);
+		*entry = NULL;
+		return -1;
+	}
+
+	/* The simulated storage delay only applies to files that exist */
+	if (!content_delay_async && 0 < (delay = latency_sample(key, content_delay))) {
+		usleep(delay);
+	}
+
+	if (0 > (fildes = _itemhold(item))){
+		content_release(map);
+		*entry = NULL;
+		return -1;
 	}
+
+	*size = __atomic_load_n(&item->size, __ATOMIC_RELAXED);
+	*entry = item;
+	return fildes;
+}
+
+/* Limits a read of an entry to its file, which in a pack is followed by others */
+static size_t _itemclamp(item_t *item, size_t len, off_t offset){
+	off_t size = __atomic_load_n(&item->size, __ATOMIC_RELAXED);
+
+	if (!ITEM_PACKED(item))
+		return len;
+	if (offset >= size)
+		return 0;
+	return (off_t) len < size - offset ? len : (size_t) (size - offset);
+}
+
+ssize_t content_pread(content_entry_t *entry, void *buf, size_t len, off_t offset){
+	return pread(entry->fildes, buf, _itemclamp(entry, len, offset), entry->offset + offset);
+}
+
+void content_close(content_entry_t *entry){
+	if (NULL == entry)
+		return;
+
+	_itemput(entry);
+	content_release(entry->map);
+}
+
+ssize_t content_size(const char *key){
+	content_map_t *map;
+	item_t *item;
+	ssize_t size = -1;
+
+	map = content_acquire();
+	if (NULL != (item = _itemfind(map, key))) {
+		/* Sizes are learned on first open, which is left to whoever reads the file */
+		if (0 > (size = __atomic_load_n(&item->size, __ATOMIC_RELAXED)))
+			size = CONTENT_SIZE_UNKNOWN;
+	}
+	content_release(map);
+
+	return size;
+}
+
+static void _itemrefresh(item_t *item){
+	struct stat st, now;
+	int gone, replaced;
+
+	/* Packed files only change when the pack is rebuilt */
+	if (ITEM_PACKED(item))
+		return;
+
+	/* A file replaced by a rename, or removed, is no longer the open one */
+	gone = 0 > stat(item->path, &now);
+
+	/* Not open: the size is read again when it is */
+	pthread_mutex_lock(&cache_lock);
+	if (0 <= item->fildes && !item->stale) {
+		if( 0 > fstat(item->fildes, &st)) {
+			fprintf(stderr, "Unable to stat file %s.\n", item->path);
+			pthread_mutex_unlock(&cache_lock);
+			return;
+		}
+		replaced = gone || st.st_ino != now.st_ino || st.st_dev != now.st_dev;
+
+		if (!replaced) {
+			__atomic_store_n(&item->size, st.st_size, __ATOMIC_RELAXED);
+		} else if (0 < item->users) {
+			/* Requests reading the old file keep it, and the size that goes with it, until they are done */
+			item->stale = 1;
+		} else {
+			_lruremove(item);
+			close(item->fildes);
+			item->fildes = FILDES_CLOSED;
+			open_fds--;
+			if (!gone)
+				__atomic_store_n(&item->size, now.st_size, __ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+int content_refresh(const char *key){
+	content_map_t *map;
+	item_t *item;
+
+	map = content_acquire();
+	if (NULL != (item = _itemfind(map, key)))
+		_itemrefresh(item);
+	content_release(map);
+
+	return item ? 0 : -1;
+}
+
+/*
+ * Asynchronous reads wait in a min-heap ordered by the time they may run.
+ * With the disk backend that is when they were submitted; the delay
+ * backend first adds the simulated storage delay to reads at offset 0.
+ * I/O threads sleep until the earliest read is due, so delayed reads
+ * occupy no thread while they wait.
+ */
+struct content_read_t{
+	item_t *item;
+	int fildes;
+	void *buf;
+	size_t len;
+	off_t offset;
+	content_done_t done;
+	void *arg;
+	struct timespec due;	/* CLOCK_MONOTONIC */
+	int index;	/* position in the heap, -1 once an I/O thread took it */
+};
+
+static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t read_cond;
+static content_read_t **pending;
+static int npending;
+static int pending_capacity;
+static int read_delays;	/* delay backend */
+
+static int _readbefore(const content_read_t *a, const content_read_t *b){
+	return a->due.tv_sec < b->due.tv_sec ||
+		(a->due.tv_sec == b->due.tv_sec && a->due.tv_nsec < b->due.tv_nsec);
+}
+
+static void _readplace(content_read_t *read, int i){
+	pending[i] = read;
+	read->index = i;
+}
+
+static void _readup(int i){
+	content_read_t *read = pending[i];
+
+	while(i > 0 && _readbefore(read, pending[(i - 1) / 2])){
+		_readplace(pending[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+	_readplace(read, i);
+}
+
+static void _readdown(int i){
+	content_read_t *read = pending[i];
+	int child;
+
+	while((child = 2 * i + 1) < npending){
+		if(child + 1 < npending && _readbefore(pending[child + 1], pending[child]))
+			child++;
+		if(!_readbefore(pending[child], read))
+			break;
+		_readplace(pending[child], i);
+		i = child;
+	}
+	_readplace(read, i);
+}
+
+/* Takes the read at position i out of the heap */
+static void _readremove(int i){
+	content_read_t *last = pending[--npending];
+
+	pending[i]->index = -1;
+	if(i == npending)
+		return;
+	_readplace(last, i);
+	_readup(i);
+	_readdown(last->index);
+}
+
+static void *_readloop(void *arg){
+	content_read_t *read;
+	struct timespec now;
+	ssize_t nread;
+
+	(void) arg;
+	pthread_mutex_lock(&read_lock);
+	for(;;){
+		if(0 == npending){
+			pthread_cond_wait(&read_cond, &read_lock);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec < pending[0]->due.tv_sec ||
+				(now.tv_sec == pending[0]->due.tv_sec && now.tv_nsec < pending[0]->due.tv_nsec)){
+			pthread_cond_timedwait(&read_cond, &read_lock, &pending[0]->due);
+			continue;
+		}
+
+		read = pending[0];
+		_readremove(0);
+		pthread_mutex_unlock(&read_lock);
+
+		nread = pread(read->fildes, read->buf, read->len, read->offset);
+		read->done(read, nread, read->arg);
+		free(read);
+
+		pthread_mutex_lock(&read_lock);
+	}
+	return NULL;
+}
+
+int content_backend(const char *name, int nthreads){
+	pthread_condattr_t attr;
+	pthread_t thread;
+	int i;
+
+	if(0 == strcmp(name, "delay"))
+		read_delays = 1;
+	else if(0 != strcmp(name, "disk"))
+		return -1;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&read_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for(i = 0; i < nthreads; i++){
+		if(0 != pthread_create(&thread, NULL, _readloop, NULL))
+			return -1;
+		pthread_detach(thread);
+	}
+	return 0;
+}
+
+content_read_t *content_read_begin(content_entry_t *entry, void *buf, size_t len, off_t offset,
+		content_done_t done, void *arg){
+	content_read_t *read = (content_read_t*) malloc(sizeof(content_read_t));
+	unsigned long delay = 0;
+
+	read->item = entry;
+	read->fildes = entry->fildes;	/* stays open while the caller holds the entry */
+	read->buf = buf;
+	read->len = _itemclamp(entry, len, offset);
+	read->offset = entry->offset + offset;
+	read->done = done;
+	read->arg = arg;
+
+	/* The origin's latency is paid once, before the first byte */
+	if(read_delays && 0 == offset)
+		delay = latency_sample(entry->key, content_delay);
+	clock_gettime(CLOCK_MONOTONIC, &read->due);
+	read->due.tv_sec += delay / 1000000;
+	read->due.tv_nsec += (delay % 1000000) * 1000;
+	if(read->due.tv_nsec >= 1000000000){
+		read->due.tv_sec++;
+		read->due.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&read_lock);
+	if(npending == pending_capacity){
+		pending_capacity = pending_capacity ? pending_capacity * 2 : 64;
+		pending = realloc(pending, pending_capacity * sizeof(content_read_t*));
+	}
+	pending[npending] = read;
+	_readup(npending++);
+	/* Only a new earliest read changes how long the I/O threads sleep */
+	if(0 == read->index)
+		pthread_cond_signal(&read_cond);
+	pthread_mutex_unlock(&read_lock);
+
+	return read;
+}
+
+#if defined(__linux__)
+static int watchfd = -1;
+static int mapwatch = -1;
+
+/* IN_ATTRIB: the link count drops when a new index is renamed over this one */
+#define MAPFILE_EVENTS (IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+/* Watched on directories; IN_CREATE and IN_MOVED_TO: a file was created or replaced */
+#define CONTENT_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_ONLYDIR)
+
+/* A directory of content files while a map's watches are set up */
+typedef struct{
+	const char *dir;	/* points into an item's path, NULL for an empty slot */
+	size_t len;
+	int wd;
+} watchdir_t;
+
+static int _intcmp(const void *a, const void *b){
+	return *(const int *) a - *(const int *) b;
+}
+
+/* Returns the length of the directory part of path, 0 if it has none */
+static size_t _dirlen(const char *path){
+	const char *slash = strrchr(path, '/');
+
+	if (NULL == slash)
+		return 0;
+	return slash == path ? 1 : (size_t) (slash - path);
+}
+
+/* Returns the file name part of path */
+static const char *_basename(const char *path){
+	const char *slash = strrchr(path, '/');
+
+	return NULL == slash ? path : slash + 1;
+}
+
+static size_t _dirhash(const char *dir, size_t len){
+	size_t hash = 2166136261u;
+
+	while (len-- > 0)
+		hash = (hash ^ (unsigned char) *dir++) * 16777619u;
+	return hash;
+}
+
+/* Hashes a watch and a file name in it, for the byname chains */
+static size_t _namehash(int wd, const char *name){
+	size_t hash = 2166136261u ^ (unsigned) wd;
+
+	while (*name)
+		hash = (hash ^ (unsigned char) *name++) * 16777619u;
+	return hash;
+}
+
+/* Watches each directory holding content files once, however many files it holds */
+static void _mapwatch(content_map_t *map){
+	size_t nslots = 2 * (size_t) map->nitems + 1;
+	watchdir_t *slots, *slot;
+	char dir[PATH_MAX];
+	const char *path;
+	size_t len, h;
+	int i, full = 0;
+
+	/* Index maps are rebuilt offline with their sizes; opening a file re-reads it */
+	if (NULL != map->index)
+		return;
+
+	slots = (watchdir_t*) calloc(nslots, sizeof(watchdir_t));
+	map->watches = (int*) malloc((map->nitems + 1) * sizeof(int));
+	for (i = 0; i < map->nitems; i++) {
+		path = map->items[i].path;
+		len = _dirlen(path);
+		for (h = _dirhash(path, len) % nslots; NULL != (slot = &slots[h])->dir; h = (h + 1) % nslots)
+			if (slot->len == len && 0 == memcmp(slot->dir, path, len))
+				break;
+
+		if (NULL == slot->dir) {
+			slot->dir = path;
+			slot->len = len;
+			slot->wd = -1;
+			if (!full && len < sizeof(dir)) {
+				if (0 == len) {
+					strcpy(dir, ".");
+				} else {
+					memcpy(dir, path, len);
+					dir[len] = '\0';
+				}
+				if (0 <= (slot->wd = inotify_add_watch(watchfd, dir, CONTENT_EVENTS))) {
+					map->watches[map->nwatches++] = slot->wd;
+				} else if (ENOSPC == errno) {
+					/* Out of watches; the remaining sizes only change via content_refresh */
+					fprintf(stderr, "Unable to watch directory %s.\n", dir);
+					full = 1;
+				}
+			}
+		}
+		map->items[i].watch = slot->wd;
+	}
+	free(slots);
+
+	/* Events name a file in a watched directory; chain the items they may concern */
+	for (map->nbyname = 1; map->nbyname < (size_t) map->nitems; map->nbyname *= 2)
+		;
+	map->byname = (int*) malloc(map->nbyname * sizeof(int));
+	map->nextname = (int*) malloc((map->nitems + 1) * sizeof(int));
+	memset(map->byname, -1, map->nbyname * sizeof(int));
+	for (i = 0; i < map->nitems; i++) {
+		if (0 > map->items[i].watch)
+			continue;
+		h = _namehash(map->items[i].watch, _basename(map->items[i].path)) & (map->nbyname - 1);
+		map->nextname[i] = map->byname[h];
+		map->byname[h] = i;
+	}
+
+	/* The kernel hands out one watch per directory, so maps share them */
+	qsort(map->watches, map->nwatches, sizeof(int), _intcmp);
+}
+
+/* Drops the watches of a replaced map that the new map does not share */
+static void _mapunwatch(content_map_t *old, content_map_t *map){
+	int i;
+
+	for (i = 0; i < old->nwatches; i++)
+		if (NULL == bsearch(&old->watches[i], map->watches, map->nwatches, sizeof(int), _intcmp))
+			inotify_rm_watch(watchfd, old->watches[i]);
+}
+
+static void *_watchloop(void *arg){
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ev;
+	content_map_t *map;
+	ssize_t len;
+	item_t *item;
+	char *p;
+	int i;
+
+	(void) arg;
+	while ((len = read(watchfd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *) p;
+
+			/* The map file itself changed or was replaced: reload it */
+			if (ev->wd == mapwatch) {
+				if (ev->mask & (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)) {
+					inotify_rm_watch(watchfd, mapwatch);
+					mapwatch = inotify_add_watch(watchfd, mapfile, MAPFILE_EVENTS);
+				}
+				content_reload(mapfile);
+				continue;
+			}
+
+			/* Only events on files in a watched directory carry a name */
+			if (0 == ev->len)
+				continue;
+
+			/* Several keys may map to the same file; maps without watches have no chains */
+			map = content_acquire();
+			if (NULL != map->byname) {
+				for (i = map->byname[_namehash(ev->wd, ev->name) & (map->nbyname - 1)]; 0 <= i; i = map->nextname[i]) {
+					item = &map->items[i];
+					if (item->watch == ev->wd && 0 == strcmp(_basename(item->path), ev->name))
+						_itemrefresh(item);
+				}
+			}
+			content_release(map);
+		}
+	}
+	return NULL;
+}
+
+int content_watch(){
+	pthread_t thread;
+
+	if (0 > (watchfd = inotify_init1(IN_CLOEXEC))) {
+		fprintf(stderr, "Unable to watch content files.\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&reload_lock);
+	mapwatch = inotify_add_watch(watchfd, mapfile, MAPFILE_EVENTS);
+	_mapwatch(current);
+	pthread_mutex_unlock(&reload_lock);
+
+	if (0 != pthread_create(&thread, NULL, _watchloop, NULL))
+		return -1;
+	pthread_detach(thread);
+
+	return 0;
+}
+#else
+static void _mapwatch(content_map_t *map){
+	(void) map;
+}
+
+static void _mapunwatch(content_map_t *old, content_map_t *map){
+	(void) old;
+	(void) map;
+}
+
+int content_watch(){
 	return -1;
 }
+#endif
+
+int content_reload(const char *filename){
+	content_map_t *map, *old;
+
+	pthread_mutex_lock(&reload_lock);
+
+	/* Build the new index off to the side; on failure keep serving the old one */
+	if (NULL == (map = mapload(filename))) {
+		pthread_mutex_unlock(&reload_lock);
+		fprintf(stderr, "Keeping the current content map.\n");
+		return -1;
+	}
+	if (0 <= watchfd)
+		_mapwatch(map);
+
+	pthread_mutex_lock(&current_lock);
+	old = current;
+	current = map;
+	pthread_mutex_unlock(&current_lock);
+
+	if (0 <= watchfd)
+		_mapunwatch(old, map);
+	pthread_mutex_unlock(&reload_lock);
+
+	/* In-flight requests keep the old map until they release it */
+	content_release(old);
+	return 0;
+}
 
 void content_destroy(){
-	int i;
-	for(i = 0; i < nitems; i++)
-		close(items[i].fildes);
-	
-	free(items);
+	pthread_mutex_lock(&current_lock);
+	content_release(current);
+	current = NULL;
+	pthread_mutex_unlock(&current_lock);
+
+	free(mapfile);
 }
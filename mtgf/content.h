@@ -1,6 +1,21 @@
 #ifndef __CONTENT_H__
 #define __CONTENT_H__
 
+#include <sys/types.h>
+
+/*
+ * A snapshot of the content map.  Descriptors returned from a map stay
+ * open until the map is released, even if the map is replaced by a
+ * reload in the meantime.
+ */
+typedef struct content_map_t content_map_t;
+
+/*
+ * An entry of a content map whose descriptor is held open for the
+ * caller between content_open and content_close.
+ */
+typedef struct content_entry_t content_entry_t;
+
 /* 
  * Initializes the content library given the information from
  * the provided file.  Each row of the file is assumed
@@ -9,16 +24,142 @@
  *
  * Subsequent calls to content_get with a key value
  * as an argument will return the file descriptor for the 
- * given file path.
+ * given file path.  Files are opened on their first lookup;
+ * a file that cannot be opened is reported once and its key
+ * is treated as not found.
  */
 int content_init(const char *filename);
 
+/* 
+ * Like content_init, but the file is a binary index compiled from a
+ * content file by the content_index tool.  The index is mapped as is,
+ * so startup does not depend on the number of keys and the pages are
+ * shared by every process serving the same index.  Sizes come from the
+ * index until a file is opened, and content files are not watched;
+ * rebuild the index to pick up changes, which reloads it like content_init.
+ * A pack (content_index -p) also holds the files themselves: every key
+ * is then read from the pack's one descriptor, and nothing else is opened.
+ */
+int content_init_binary(const char *filename);
+
 /* 
  * Returns the file descriptor associated with the input key.
- * Returns -1 if the the key is not found
+ * Returns -1 if the the key is not found.  The descriptor is not held,
+ * so the descriptor cache may close it at any time; use content_open.
+ * Also returns -1 for a key served from a pack, whose file does not
+ * start at the beginning of the descriptor.
  */
 int content_get(const char *key);
 
+/* 
+ * Like content_get, but holds the descriptor open until the returned
+ * *entry is passed to content_close, even across a content_reload, and
+ * stores the size in bytes of the file in *size.  The size is the one
+ * recorded when the file was opened or by the latest refresh, so the
+ * caller does not need to fstat the descriptor.  Read the file with
+ * content_pread or content_read_begin, which also work for packs.
+ * Returns -1 and sets *entry to NULL if the the key is not found
+ */
+int content_open(const char *key, size_t *size, content_entry_t **entry);
+
+/* 
+ * Reads up to len bytes at offset of the file of an entry held by
+ * content_open, like pread(2).  In a pack the offset is taken from the
+ * start of the file and the read stops at its end.
+ */
+ssize_t content_pread(content_entry_t *entry, void *buf, size_t len, off_t offset);
+
+/* 
+ * Releases an entry obtained from content_open.  The descriptor stays
+ * cached and may be closed later to make room for other files.
+ * Does nothing if entry is NULL.
+ */
+void content_close(content_entry_t *entry);
+
+/* 
+ * Sets how many content descriptors may stay open at once.  Files are
+ * opened on demand and idle descriptors beyond this limit are closed,
+ * least recently used first.  Descriptors in use are never closed.
+ * Defaults to half of RLIMIT_NOFILE.
+ */
+void content_set_maxfds(int n);
+
+/* 
+ * Returns the current map with a reference held for the caller.
+ */
+content_map_t *content_acquire();
+
+/* 
+ * Drops a reference obtained from content_acquire.
+ * The last reference to a replaced map closes its descriptors.
+ */
+void content_release(content_map_t *map);
+
+/* 
+ * Returns the size in bytes of the file associated with the input key,
+ * as recorded by the index, when the file was opened or by the latest
+ * refresh.  Unlike content_get this never delays nor opens the file.
+ * Returns -1 if the key is not found, and CONTENT_SIZE_UNKNOWN if the
+ * file was never opened so its size is not known yet.
+ */
+#define CONTENT_SIZE_UNKNOWN -2
+
+ssize_t content_size(const char *key);
+
+/* 
+ * Re-reads the size of the file associated with the input key after it
+ * changed on disk.  A file replaced at its path, e.g. by a rename, is
+ * opened again once the requests reading the old one are done.
+ * Returns -1 if the key is not found
+ */
+int content_refresh(const char *key);
+
+/*
+ * An asynchronous read of a content file, see content_read_begin.
+ */
+typedef struct content_read_t content_read_t;
+
+/*
+ * Called from an I/O thread when a read completes, with the number of
+ * bytes read, or -1 on error.  The read is freed once this returns.
+ */
+typedef void (*content_done_t)(content_read_t *read, ssize_t nread, void *arg);
+
+/* 
+ * Starts the backend that serves content_read_begin with nthreads I/O
+ * threads.  "disk" reads local files as soon as possible; "delay" first
+ * waits out the simulated storage delay (see latency.h) on reads at
+ * offset 0, without holding a thread while it waits.  Lookups do not
+ * delay themselves when content_delay_async is set.
+ * Returns -1 if the name is unknown or the threads cannot be started.
+ */
+int content_backend(const char *name, int nthreads);
+
+/* 
+ * Starts reading up to len bytes at offset from the file of an entry
+ * held by content_open, and returns at once.  done is called with arg
+ * when the read completes; the entry must stay open until then.
+ */
+content_read_t *content_read_begin(content_entry_t *entry, void *buf, size_t len, off_t offset,
+		content_done_t done, void *arg);
+
+/* 
+ * Builds a new map from the given file and atomically replaces the
+ * current one.  Requests already holding the old map keep using its
+ * descriptors until they release it.  Returns -1, keeping the current
+ * map, if the new one cannot be loaded.
+ */
+int content_reload(const char *filename);
+
+/* 
+ * Starts a background thread that refreshes the recorded size whenever
+ * a content file is modified, and reloads the map when the file given
+ * to content_init changes (inotify, Linux only).  Content files are
+ * watched through their directories, one watch per directory.  Returns -1 if change
+ * notification is not available.
+ */
+int content_watch();
+
 /* 
  * Frees all memory and closes all file descriptors
  * associated with the cache.
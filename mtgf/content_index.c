@@ -0,0 +1,216 @@
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "content_index.h"
+#include "bloom.h"
+
+#define USAGE                                                          \
+  "usage:\n"                                                           \
+  "  content_index [-p] [content_file] [index_file]\n"                 \
+  "Compiles a content map (see content.txt) into a binary index that\n" \
+  "gfserver_main maps directly with -b.  With -p the index is a pack\n" \
+  "that also holds the bytes of every file, served from one descriptor.\n"
+
+#define COPY_BUFSIZE (64 * 1024)
+
+typedef struct{
+	char *key;
+	char *path;
+	int64_t size;
+	uint64_t offset;	/* in the data of a pack */
+} line_t;
+
+static int _linecmp(const void *a, const void *b){
+	return strcmp(((const line_t*) a)->key, ((const line_t*) b)->key);
+}
+
+static uint64_t _alignup(uint64_t offset, uint64_t align){
+	return (offset + align - 1) & ~(align - 1);
+}
+
+/* Writes zeros up to offset */
+static void _pad(FILE *out, uint64_t *pos, uint64_t offset){
+	static const char zeros[CONTENT_PACK_PAGE];
+
+	while(*pos < offset){
+		uint64_t n = offset - *pos < sizeof(zeros) ? offset - *pos : sizeof(zeros);
+		fwrite(zeros, 1, n, out);
+		*pos += n;
+	}
+}
+
+/*
+ * Copies exactly size bytes of the file at path into the pack, padding
+ * with zeros if it shrank since it was sized, so later offsets hold.
+ */
+static void _packfile(FILE *out, uint64_t *pos, const line_t *line){
+	static char buffer[COPY_BUFSIZE];
+	uint64_t end = *pos + line->size;
+	size_t n;
+	FILE *in;
+
+	if( NULL == (in = fopen(line->path, "r"))){
+		fprintf(stderr, "Unable to read file %s.\n", line->path);
+	}else{
+		while(*pos < end && 0 < (n = fread(buffer, 1, end - *pos < sizeof(buffer) ? end - *pos : sizeof(buffer), in))){
+			fwrite(buffer, 1, n, out);
+			*pos += n;
+		}
+		fclose(in);
+		if(*pos < end)
+			fprintf(stderr, "File %s shrank while packing.\n", line->path);
+	}
+	_pad(out, pos, end);
+}
+
+int main(int argc, char **argv){
+	content_index_header_t header;
+	content_index_entry_t entry;
+	uint64_t *bloom;
+	line_t *lines;
+	int nlines = 0, capacity = 16;
+	char *line = NULL, *ptr, *key, *path, *tmpname;
+	size_t linecap = 0;
+	uint64_t offset = 0, pos;
+	struct stat st;
+	FILE *in, *out;
+	ssize_t len;
+	int i, option_char, pack = 0;
+
+	while(-1 != (option_char = getopt(argc, argv, "p"))){
+		if('p' != option_char){
+			fprintf(stderr, "%s", USAGE);
+			exit(EXIT_FAILURE);
+		}
+		pack = 1;
+	}
+	if(2 != argc - optind){
+		fprintf(stderr, "%s", USAGE);
+		exit(EXIT_FAILURE);
+	}
+	argv += optind - 1;
+
+	if( NULL == (in = fopen(argv[1], "r"))){
+		fprintf(stderr, "Unable to open content map %s.\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Same rules as the text loader: "key path", malformed lines skipped */
+	lines = (line_t*) malloc(capacity * sizeof(line_t));
+	while( 0 < (len = getline(&line, &linecap, in))){
+		while(len > 0 && ('\n' == line[len - 1] || '\r' == line[len - 1]))
+			line[--len] = '\0';
+
+		ptr = line;
+		key = strsep(&ptr, " \t");
+		path = strsep(&ptr, " \t");
+		if(NULL == path || '\0' == *key || '\0' == *path){
+			if('\0' != *line)
+				fprintf(stderr, "Skipping malformed content line %s.\n", line);
+			continue;
+		}
+
+		if(nlines == capacity){
+			capacity *= 2;
+			lines = realloc(lines, capacity * sizeof(line_t));
+		}
+		lines[nlines].key = strdup(key);
+		lines[nlines].path = strdup(path);
+		lines[nlines].size = -1;
+		lines[nlines].offset = 0;
+		if(0 == stat(path, &st))
+			lines[nlines].size = st.st_size;
+		else
+			fprintf(stderr, "Unable to stat file %s.\n", path);
+		nlines++;
+	}
+	free(line);
+	fclose(in);
+
+	qsort(lines, nlines, sizeof(line_t), _linecmp);
+
+	/* Write next to the target and rename, so a watching server never maps a partial index */
+	tmpname = malloc(strlen(argv[2]) + 5);
+	sprintf(tmpname, "%s.tmp", argv[2]);
+	if( NULL == (out = fopen(tmpname, "w"))){
+		fprintf(stderr, "Unable to create index %s.\n", tmpname);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CONTENT_INDEX_MAGIC, sizeof(header.magic));
+	header.nitems = nlines;
+	header.bloomwords = bloom_words(nlines);
+	header.arena = sizeof(header) + (uint64_t) nlines * sizeof(entry) + header.bloomwords * sizeof(uint64_t);
+	for(i = 0; i < nlines; i++)
+		header.arenalen += strlen(lines[i].key) + strlen(lines[i].path) + 2;
+	if(header.arenalen > UINT32_MAX){
+		fprintf(stderr, "Content map %s is too large to index.\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Lay out the data: page-sized files on page boundaries, small ones packed densely */
+	if(pack){
+		header.data = _alignup(header.arena + header.arenalen, CONTENT_PACK_PAGE);
+		for(i = 0; i < nlines; i++){
+			if(0 > lines[i].size)
+				continue;
+			offset = _alignup(offset, lines[i].size >= CONTENT_PACK_PAGE ? CONTENT_PACK_PAGE : CONTENT_PACK_ALIGN);
+			lines[i].offset = offset;
+			offset += lines[i].size;
+		}
+		offset = 0;
+	}
+	fwrite(&header, sizeof(header), 1, out);
+
+	for(i = 0; i < nlines; i++){
+		entry.key = offset;
+		offset += strlen(lines[i].key) + 1;
+		entry.path = offset;
+		offset += strlen(lines[i].path) + 1;
+		entry.size = lines[i].size;
+		entry.offset = lines[i].offset;
+		fwrite(&entry, sizeof(entry), 1, out);
+	}
+
+	bloom = (uint64_t*) calloc(header.bloomwords, sizeof(uint64_t));
+	for(i = 0; i < nlines; i++)
+		bloom_add(bloom, header.bloomwords, lines[i].key);
+	fwrite(bloom, sizeof(uint64_t), header.bloomwords, out);
+	free(bloom);
+
+	for(i = 0; i < nlines; i++){
+		fwrite(lines[i].key, strlen(lines[i].key) + 1, 1, out);
+		fwrite(lines[i].path, strlen(lines[i].path) + 1, 1, out);
+	}
+
+	if(pack){
+		pos = header.arena + header.arenalen;
+		_pad(out, &pos, header.data);
+		for(i = 0; i < nlines; i++){
+			if(0 > lines[i].size)
+				continue;
+			_pad(out, &pos, header.data + lines[i].offset);
+			_packfile(out, &pos, &lines[i]);
+		}
+	}
+
+	for(i = 0; i < nlines; i++){
+		free(lines[i].key);
+		free(lines[i].path);
+	}
+	free(lines);
+
+	if(0 != fclose(out) || 0 > rename(tmpname, argv[2])){
+		fprintf(stderr, "Unable to write index %s.\n", argv[2]);
+		unlink(tmpname);
+		exit(EXIT_FAILURE);
+	}
+	free(tmpname);
+
+	return EXIT_SUCCESS;
+}
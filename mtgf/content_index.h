@@ -0,0 +1,46 @@
+#ifndef __CONTENT_INDEX_H__
+#define __CONTENT_INDEX_H__
+
+#include <stdint.h>
+
+/*
+ * On-disk layout of a compiled content map, as written by content_index
+ * and mapped by content_init_binary:
+ *
+ *   content_index_header_t
+ *   content_index_entry_t[nitems]   sorted by key (strcmp order)
+ *   uint64_t[bloomwords]            Bloom filter of the keys (see bloom.h)
+ *   string arena                    NUL-terminated keys and paths
+ *   file data                       packs only, from a page boundary
+ *
+ * A pack (content_index -p) carries the bytes of every file after the
+ * arena, so all keys are served from the one descriptor of the pack.
+ * Files of at least a page start on a page boundary; smaller ones are
+ * packed CONTENT_PACK_ALIGN apart so many share a page of the page cache.
+ *
+ * All integers are in host byte order; the index is built on the machine
+ * that serves it.
+ */
+
+#define CONTENT_INDEX_MAGIC "GFIDX03"
+#define CONTENT_PACK_ALIGN 64
+#define CONTENT_PACK_PAGE 4096
+
+typedef struct{
+	char magic[8];	/* CONTENT_INDEX_MAGIC, NUL-terminated */
+	uint32_t nitems;
+	uint32_t reserved;
+	uint64_t bloomwords;
+	uint64_t arena;	/* offset of the string arena from the start of the file */
+	uint64_t arenalen;
+	uint64_t data;	/* offset of the file data of a pack, 0 if not a pack */
+} content_index_header_t;
+
+typedef struct{
+	uint32_t key;	/* offsets into the string arena */
+	uint32_t path;
+	int64_t size;	/* file size when the index was built, -1 if missing */
+	uint64_t offset;	/* of the file's bytes from data, in a pack */
+} content_index_entry_t;
+
+#endif
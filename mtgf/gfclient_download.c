@@ -4,12 +4,27 @@
 
 /* Additional packages and define */
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
 #include "steque.h"
+#include "affinity.h"
+// Per-request lines are INFO; build with -DMYLOG_PRIORITY=WARN to compile them out
+#ifndef MYLOG_PRIORITY
+#define MYLOG_PRIORITY INFO
+#endif
+#include "log.h"
 #define BUFSIZE 512
 /* End */
 
 #define MAX_THREADS 1024
+#define BACKOFF_BASE_USEC 10000
+#define BACKOFF_MAX_USEC 1000000
 #define PATH_BUFFER_SIZE 512
+#define SINK_BUFSIZE (256 * 1024)
+#define SINK_ALIGN 4096
+#define DIRCACHE_BUCKETS 256
+#define DEQUEUE_BATCH 8
 
 #define USAGE                                                             \
   "usage:\n"                                                              \
@@ -20,7 +35,9 @@
   "  -p [server_port]    Server port (Default: 39474)\n"                  \
   "  -w [workload_path]  Path to workload file (Default: workload.txt)\n" \
   "  -t [nthreads]       Number of threads (Default 8 Max: 1024)\n"       \
-  "  -n [num_requests]   Request download total (Default: 16)\n"
+  "  -n [num_requests]   Request download total (Default: 16)\n"          \
+  "  -a                  Pin worker threads to cores\n"                   \
+  "  -b [retries]        Retries with backoff on a shed ERROR (Default: 0)\n"
 
 /* OPTIONS DESCRIPTOR ====================================================== */
 static struct option gLongOptions[] = {
@@ -30,6 +47,8 @@ static struct option gLongOptions[] = {
     {"workload", required_argument, NULL, 'w'},
     {"nthreads", required_argument, NULL, 't'},
     {"nrequests", required_argument, NULL, 'n'},
+    {"affinity", no_argument, NULL, 'a'},
+    {"retries", required_argument, NULL, 'b'},
     {NULL, 0, NULL, 0}};
 
 static void Usage() { fprintf(stderr, "%s", USAGE); }
@@ -37,30 +56,116 @@ static void Usage() { fprintf(stderr, "%s", USAGE); }
 static void localPath(char *req_path, char *local_path) {
   static int counter = 0;
 
-  sprintf(local_path, "%s-%06d", &req_path[1], counter++);
+  // Worker threads share the sequence, so every download gets its own name
+  sprintf(local_path, "%s-%06d", &req_path[1], __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
 }
 
-static FILE *openFile(char *path) {
-  char *cur, *prev;
-  FILE *ans;
+/*
+ * Directories already created during this run, kept open so that output
+ * files are created with a single openat relative to them. Lookups share
+ * the read lock; only the first download into a directory takes it for
+ * writing.
+ */
+typedef struct dir_entry {
+  char *path;
+  int fd;
+  struct dir_entry *next;
+} dir_entry_t;
+
+static dir_entry_t *dircache[DIRCACHE_BUCKETS];
+static pthread_rwlock_t dircache_lock = PTHREAD_RWLOCK_INITIALIZER;
 
-  /* Make the directory if it isn't there */
-  prev = path;
-  while (NULL != (cur = strchr(prev + 1, '/'))) {
-    *cur = '\0';
+static unsigned int dircache_bucket(const char *dir) {
+  unsigned int hash = 2166136261u;
 
-    if (0 > mkdir(&path[0], S_IRWXU)) {
-      if (errno != EEXIST) {
+  while (*dir) {
+    hash = (hash ^ (unsigned char)*dir++) * 16777619u;
+  }
+  return hash % DIRCACHE_BUCKETS;
+}
+
+/* Returns the cached descriptor of dir, or -1. Needs dircache_lock. */
+static int dircache_find(const char *dir, unsigned int bucket) {
+  for (dir_entry_t *entry = dircache[bucket]; entry; entry = entry->next) {
+    if (strcmp(entry->path, dir) == 0)
+      return entry->fd;
+  }
+  return -1;
+}
+
+/* Returns a descriptor for dir, creating it and its parents on first use. */
+static int dircache_get(char *dir) {
+  unsigned int bucket = dircache_bucket(dir);
+  char *cur, *prev;
+  int fd;
+
+  pthread_rwlock_rdlock(&dircache_lock);
+  fd = dircache_find(dir, bucket);
+  pthread_rwlock_unlock(&dircache_lock);
+  if (fd >= 0)
+    return fd;
+
+  pthread_rwlock_wrlock(&dircache_lock);
+  if (0 > (fd = dircache_find(dir, bucket))) {
+    /* Make the directory if it isn't there */
+    prev = dir;
+    while (NULL != (cur = strchr(prev + 1, '/'))) {
+      *cur = '\0';
+      if (0 > mkdir(dir, S_IRWXU) && errno != EEXIST) {
         perror("Unable to create directory");
         exit(EXIT_FAILURE);
       }
+      *cur = '/';
+      prev = cur;
+    }
+    if (0 > mkdir(dir, S_IRWXU) && errno != EEXIST) {
+      perror("Unable to create directory");
+      exit(EXIT_FAILURE);
     }
 
-    *cur = '/';
-    prev = cur;
+    if (0 > (fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC))) {
+      perror("Unable to open directory");
+      exit(EXIT_FAILURE);
+    }
+
+    dir_entry_t *entry = malloc(sizeof(*entry));
+    entry->path = strdup(dir);
+    entry->fd = fd;
+    entry->next = dircache[bucket];
+    dircache[bucket] = entry;
+  }
+  pthread_rwlock_unlock(&dircache_lock);
+
+  return fd;
+}
+
+/* Closes and frees every cached directory. */
+static void dircache_destroy() {
+  for (int i = 0; i < DIRCACHE_BUCKETS; i++) {
+    while (dircache[i]) {
+      dir_entry_t *entry = dircache[i];
+      dircache[i] = entry->next;
+      close(entry->fd);
+      free(entry->path);
+      free(entry);
+    }
+  }
+}
+
+static int openFile(char *path) {
+  char *name = strrchr(path, '/');
+  int dirfd = AT_FDCWD;
+  int ans;
+
+  if (name && name > path) {
+    *name = '\0';
+    dirfd = dircache_get(path);
+    *name++ = '/';
+  } else {
+    name = path;
   }
 
-  if (NULL == (ans = fopen(&path[0], "w"))) {
+  if (0 > (ans = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))) {
     perror("Unable to open file");
     exit(EXIT_FAILURE);
   }
@@ -68,22 +173,109 @@ static FILE *openFile(char *path) {
   return ans;
 }
 
+/*
+ * Destination of a download. The library hands the body over in small
+ * chunks; they are gathered in a large aligned buffer and written to the
+ * file with one write(2) per SINK_BUFSIZE bytes, with no stdio copy.
+ */
+typedef struct {
+  int fd;
+  char *buffer;
+  size_t used;
+} sink_t;
+
+/* Writes out whatever the sink has gathered. */
+static void sink_flush(sink_t *sink) {
+  char *data = sink->buffer;
+
+  while (sink->used > 0) {
+    ssize_t written = write(sink->fd, data, sink->used);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("Unable to write file");
+      break;
+    }
+    data += written;
+    sink->used -= written;
+  }
+  sink->used = 0;
+}
+
+/* Reserves the file's blocks up front, or just sets its size */
+static void preallocate(int fd, size_t file_len) {
+  if (0 != posix_fallocate(fd, 0, file_len) && 0 > ftruncate(fd, file_len))
+    perror("Unable to preallocate file");
+}
+
 /* Callbacks ========================================================= */
+static void headercb(void *header, size_t header_len, void *arg) {
+  sink_t *sink = (sink_t *)arg;
+  char text[64], status[16];
+  size_t file_len;
+
+  // The header is not NUL-terminated
+  if (header_len >= sizeof(text))
+    header_len = sizeof(text) - 1;
+  memcpy(text, header, header_len);
+  text[header_len] = '\0';
+
+  if (sscanf(text, "GETFILE %15s %zu", status, &file_len) == 2 && strcmp(status, "OK") == 0 && file_len > 0)
+    preallocate(sink->fd, file_len);
+}
+
 static void writecb(void *data, size_t data_len, void *arg) {
-  FILE *file = (FILE *)arg;
-  fwrite(data, 1, data_len, file);
+  sink_t *sink = (sink_t *)arg;
+
+  while (data_len > 0) {
+    size_t take = SINK_BUFSIZE - sink->used;
+    if (take > data_len)
+      take = data_len;
+    memcpy(sink->buffer + sink->used, data, take);
+    sink->used += take;
+    data = (char *)data + take;
+    data_len -= take;
+
+    if (sink->used == SINK_BUFSIZE)
+      sink_flush(sink);
+  }
 }
 
 // global varibles
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t cond = PTHREAD_COND_INITIALIZER; 
+pthread_cond_t cond = PTHREAD_COND_INITIALIZER; // workers wait here for paths
+pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER; // the boss waits here for completion
 steque_t* work_queue;
-int nrequests_done = 0; 
+int nrequests_done = 0; // requests taken by a worker
+int nrequests_completed = 0; // requests fully processed
 unsigned short port = 39474;
-int returncode = 0;
 int nthreads = 8;
 int nrequests = 14;
 char *server = "localhost";
+bool pin_threads = false;
+int max_retries = 0;
+
+/*
+ * Sleeps before retry number 'attempt' of a request the server shed.
+ * Uses exponential backoff with full jitter so that clients turned away
+ * together do not all come back at the same moment.
+ */
+static void backoff(int attempt) {
+  static __thread unsigned int seed = 0;
+  long ceiling = BACKOFF_BASE_USEC;
+
+  if (seed == 0) {
+    seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)&seed;
+  }
+  for (int i = 0; i < attempt && ceiling < BACKOFF_MAX_USEC; i++) {
+    ceiling *= 2;
+  }
+  if (ceiling > BACKOFF_MAX_USEC) {
+    ceiling = BACKOFF_MAX_USEC;
+  }
+
+  usleep(rand_r(&seed) % ceiling);
+}
 
 /**
  * Processes a main request to download a file from a server and save it locally.
@@ -103,37 +295,57 @@ void main_request_process(char* filepath) {
   // Define variables for request handling and local file managemen
   gfcrequest_t* gfr;
   char local_path[BUFSIZE]; // Buffer to hold the local file path
-  FILE *file = NULL; // File pointer for the local file
+  sink_t sink = {.fd = -1, .buffer = NULL, .used = 0}; // Local file and its write buffer
+  int returncode; // result of the last attempt, private to this worker
 
   // Convert the server filepath to a local path equivalent
   localPath(filepath, local_path);
 
   // Open the local file for writing the downloaded content
-  file = openFile(local_path);
-
-   // Create and initialize the GFC request
-  gfr = gfc_create();
-  gfc_set_server(&gfr, server); // Set the server addres
-  gfc_set_path(&gfr, filepath); // Set the path of the file to request
-  gfc_set_port(&gfr, port); // Set the server port
-  gfc_set_writefunc(&gfr, writecb); // Set the callback function for writing data to the file
-  gfc_set_writearg(&gfr, file); // Set the file pointer as the argument for the callback
+  sink.fd = openFile(local_path);
+  if (posix_memalign((void **)&sink.buffer, SINK_ALIGN, SINK_BUFSIZE) != 0) {
+    perror("Unable to allocate write buffer");
+    exit(EXIT_FAILURE);
+  }
 
-  // Log the request details
-  fprintf(stdout, "Requesting %s%s\n", server, filepath);
+  for (int attempt = 0; ; attempt++) {
+    // Create and initialize the GFC request
+    gfr = gfc_create();
+    gfc_set_server(&gfr, server); // Set the server addres
+    gfc_set_path(&gfr, filepath); // Set the path of the file to request
+    gfc_set_port(&gfr, port); // Set the server port
+    gfc_set_writefunc(&gfr, writecb); // Set the callback function for writing data to the file
+    gfc_set_writearg(&gfr, &sink); // Set the sink as the argument for the callback
+    gfc_set_headerfunc(&gfr, headercb); // Preallocate the file once its length is known
+    gfc_set_headerarg(&gfr, &sink);
+
+    // Log the request details
+    L(INFO, "Requesting %s%s", server, filepath);
+
+    // Perform the request; an ERROR carries no body, so it is safe to retry
+    returncode = gfc_perform(&gfr);
+    if (returncode < 0 || gfc_get_status(&gfr) != GF_ERROR || attempt >= max_retries)
+      break;
+
+    // The server is shedding load, back off before asking again
+    gfc_cleanup(&gfr);
+    backoff(attempt);
+  }
 
-  // Perform the request and check for errors
-  if (0 > (returncode = gfc_perform(&gfr))) {
+  // Check for errors
+  if (0 > returncode) {
      // If there was an error, log it and clean up
-    fprintf(stdout, "gfc_perform returned an error %d\n", returncode);
-    fclose(file); // Close the file
+    L(WARN, "gfc_perform returned an error %d", returncode);
+    close(sink.fd); // Close the file
     // Attempt to delete the local file if there was an error
     if (0 > unlink(local_path))
       fprintf(stderr, "warning: unlink failed on %s\n", local_path);
   } else {
-    // Close the file if the request was successful
-    fclose(file);
+    // Write out the tail and close the file if the request was successful
+    sink_flush(&sink);
+    close(sink.fd);
   }
+  free(sink.buffer);
 
   // Check the status of the request and handle errors
   if (gfc_get_status(&gfr) != GF_OK) {
@@ -143,8 +355,8 @@ void main_request_process(char* filepath) {
   }
 
   // Log the status and the amount of data received
-  fprintf(stdout, "Status: %s\n", gfc_strstatus(gfc_get_status(&gfr)));
-  fprintf(stdout, "Received %zu of %zu bytes\n", gfc_get_bytesreceived(&gfr), gfc_get_filelen(&gfr));
+  L(INFO, "Status: %s", gfc_strstatus(gfc_get_status(&gfr)));
+  L(INFO, "Received %zu of %zu bytes", gfc_get_bytesreceived(&gfr), gfc_get_filelen(&gfr));
 
   // Clean up the GFC request object
   gfc_cleanup(&gfr);
@@ -157,12 +369,20 @@ void main_request_process(char* filepath) {
 
 /*
  * Entry point for worker threads responsible for handling requests.
- * Continuously check for and processes requests from a shared work queue, 
- * coordinating with other threads through synchronization primitives 
- * such as mutexes and condition variables
+ * Continuously check for and processes requests from a shared work queue,
+ * taking a small batch of paths per lock acquisition. Wakeups are chained:
+ * a worker that leaves work behind signals exactly one other, and so does
+ * each worker that exits once every request has been taken, so no request
+ * ever wakes the whole pool.
  */
-void *thread_handle_req() {
-  char *req_obj;
+void *thread_handle_req(void *arg) {
+  char *batch[DEQUEUE_BATCH];
+
+  // Pin to the core chosen at creation before any per-request buffers are touched
+  int pinned;
+  if (pin_threads && 0 != (pinned = affinity_pin((int)(intptr_t)arg))) {
+    fprintf(stderr, "Unable to pin worker thread: %s\n", strerror(pinned));
+  }
 
   while (1) {
     pthread_mutex_lock(&mutex);
@@ -172,26 +392,41 @@ void *thread_handle_req() {
       pthread_cond_wait(&cond, &mutex);
     }
 
-    // Check if all requests have been processed
-    if (nrequests_done >= nrequests) {
+    // Check if all requests have been taken; pass the news on to one more waiter
+    if (steque_isempty(work_queue)) {
       pthread_mutex_unlock(&mutex);
+      pthread_cond_signal(&cond);
       break; // Exit loop and thread
     }
 
-    // Pop a request object from the queue if available
-    if (!steque_isempty(work_queue)) {
-      req_obj = steque_pop(work_queue);
+    // Take a fair share of the queue, capped, so one lock serves several paths
+    int n = 1 + steque_size(work_queue) / nthreads;
+    if (n > DEQUEUE_BATCH)
+      n = DEQUEUE_BATCH;
+    if (n > steque_size(work_queue))
+      n = steque_size(work_queue);
+    for (int i = 0; i < n; i++) {
+      batch[i] = steque_pop(work_queue);
       nrequests_done += 1; // Mark this request as being processed
     }
+    bool more = !steque_isempty(work_queue) || nrequests_done >= nrequests;
 
     pthread_mutex_unlock(&mutex);
 
-    // Signal or broadcast that a request has been taken for processing
-    pthread_cond_broadcast(&cond);
+    // Hand off to one other worker if work remains, or to start the exit chain
+    if (more)
+      pthread_cond_signal(&cond);
 
-    if (req_obj) {
-      main_request_process(req_obj); // Process the request
+    for (int i = 0; i < n; i++) {
+      main_request_process(batch[i]); // Process the request
     }
+
+    // Only the last completed request wakes the boss
+    pthread_mutex_lock(&mutex);
+    nrequests_completed += n;
+    if (nrequests_completed >= nrequests)
+      pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&mutex);
   }
 
   return NULL; // Exit thread
@@ -204,7 +439,7 @@ void *thread_handle_req() {
 void create_worker_threads(pthread_t* threads){
     for (int i = 0; i < nthreads; i++) {
         // create thread
-        int res = pthread_create(&threads[i], NULL, thread_handle_req, NULL);
+        int res = pthread_create(&threads[i], NULL, thread_handle_req, (void *)(intptr_t)i);
         if (res != 0) {
             fprintf(stderr, "Failed to create thread %d: return code %d\n", i, res); // checks for thread creation error
             exit(EXIT_FAILURE);
@@ -237,12 +472,11 @@ void wait_for_requests_completion() {
   // boss waiting
   pthread_mutex_lock(&mutex);
 
-  // conditional wait while nonempty queue
-  while (nrequests_done != nrequests) {
-    pthread_cond_wait(&cond, &mutex);
+  // conditional wait until the workers finished every request
+  while (nrequests_completed < nrequests) {
+    pthread_cond_wait(&done_cond, &mutex);
   }
   pthread_mutex_unlock(&mutex);
-  pthread_cond_broadcast(&cond);
 }
 
 /* Waits for all worker threads to complete their execution. */
@@ -266,7 +500,6 @@ int main(int argc, char **argv) {
   // char *req_path = NULL;
 
 
-  // int returncode = 0; // comment out for global access
   // int nthreads = 8; // comment out for global access
   // char local_path[PATH_BUFFER_SIZE];
   // int nrequests = 14; // comment out for global access
@@ -276,8 +509,11 @@ int main(int argc, char **argv) {
 
   setbuf(stdout, NULL);  // disable caching
 
+  // Per-request output goes through per-thread buffers and one writer thread
+  log_init(STDOUT_FILENO);
+
   // Parse and set command line arguments
-  while ((option_char = getopt_long(argc, argv, "p:n:hs:t:r:w:", gLongOptions,
+  while ((option_char = getopt_long(argc, argv, "p:n:hs:t:r:w:ab:", gLongOptions,
                                     NULL)) != -1) {
     switch (option_char) {
 
@@ -297,6 +533,12 @@ int main(int argc, char **argv) {
       case 'p':  // port
         port = atoi(optarg);
         break;
+      case 'a':  // affinity
+        pin_threads = true;
+        break;
+      case 'b':  // retries
+        max_retries = atoi(optarg);
+        break;
       default:
         Usage();
         exit(1);
@@ -341,6 +583,7 @@ int main(int argc, char **argv) {
   /*  use for any global cleanup for AFTER your thread
       pool has terminated. */
   gfc_global_cleanup(); // clean global variables             
+  dircache_destroy(); // close the cached output directories
   free(threads); // free malloc pointers
   free(work_queue);
   return 0;
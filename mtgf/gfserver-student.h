@@ -12,17 +12,45 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include "steque.h"
+#include "affinity.h"
+#include "latency.h"
 #include <stdbool.h>
+#include <time.h>
+#include <stdint.h>
 #define BUFSIZE 512
+#define MAX_THREADS 1024
+#define IO_THREADS 4 // content backend threads with -A
+#define READ_CHUNK 65536 // bytes per asynchronous read
 
 // steque_request data structure inspired by steque item and enqueue
 typedef struct steque_request {
 	const char *filepath;
 	void* arg;
     gfcontext_t *context;
+    struct timespec enqueued; // CLOCK_MONOTONIC time the request was queued
+    bool large; // queued on the large-file lane
+    bool started; // header sent, transfer in progress
+    int fildes; // content descriptor once started
+    size_t file_len; // bytes to send in total
+    size_t offset; // bytes sent so far
+    content_entry_t *entry; // content entry holding fildes open
+    char *chunk; // READ_CHUNK buffer for asynchronous reads
+    ssize_t nread; // result of the last asynchronous read
 } steque_request;
 
+// outcome of one turn spent on a request by a worker
+typedef enum {
+    SERVE_DONE, // finished, free the request
+    SERVE_REQUEUE, // unfinished, put it back at the end of its lane
+    SERVE_PENDING // waiting on an asynchronous read that requeues it
+} serve_result_t;
+
 void init_threads(size_t numthreads);
 void cleanup_threads();
 
+long elapsed_usec(const struct timespec *since);
+int queued_requests();
+long oldest_wait_usec();
+void grow_pthreads(long waited);
+
 #endif // __GF_SERVER_STUDENT_H__
@@ -8,21 +8,54 @@
   "options:\n"                                                                                    \
   "  -h                  Show this help message.\n"                                               \
   "  -t [nthreads]       Number of threads (Default: 16)\n"                                       \
+  "  -l [min_threads]    Minimum number of threads kept alive (Default: nthreads)\n"              \
+  "  -x [max_threads]    Maximum number of threads the pool may grow to (Default: nthreads)\n"    \
+  "  -i [idle_timeout]   Seconds an idle thread waits before retiring (Default: 30)\n"            \
+  "  -g [grow_wait]      Queue wait that triggers pool growth, default 10000 (microseconds)\n"    \
+  "  -c                  Workload is CPU-bound, cap the pool at the number of cores\n"            \
+  "  -a                  Pin worker threads to cores\n"                                           \
+  "  -q [max_queue]      Requests queued before new ones are shed, default 0 (unbounded)\n"       \
+  "  -w [max_wait]       Queue wait after which a request is shed, default 0 (microseconds)\n"    \
+  "  -s [small_limit]    Largest file served from the small lane (Default: 1048576 bytes)\n"      \
+  "  -R [reserved]       Workers reserved for the small lane (Default: 1)\n"                      \
+  "  -Q [quantum]        Bytes sent per turn before a transfer is requeued, default 0 (off)\n"    \
+  "  -f [max_fds]        Content descriptors kept open (Default: half of RLIMIT_NOFILE)\n"        \
   "  -m [content_file]   Content file mapping keys to content files (Default: content.txt\n"      \
+  "  -b                  Content file is a binary index or pack built by content_index\n"         \
   "  -p [listen_port]    Listen port (Default: 39474)\n"                                          \
   "  -d [delay]          Delay in content_get, default 0, range 0-5000000 "                       \
-  "(microseconds)\n "
+  "(microseconds)\n"                                                                              \
+  "  -D [distribution]   Delay distribution: fixed, exp or lognormal[:sigma] (Default: fixed)\n"  \
+  "  -P [latency_file]   Per-path mean delays, one \"prefix microseconds\" per line\n"            \
+  "  -A                  Read content asynchronously, delays do not block a worker\n "
 
 /* OPTIONS DESCRIPTOR ====================================================== */
 static struct option gLongOptions[] = {
     {"content", required_argument, NULL, 'm'},
+    {"binary", no_argument, NULL, 'b'},
     {"port", required_argument, NULL, 'p'},
     {"nthreads", required_argument, NULL, 't'},
+    {"minthreads", required_argument, NULL, 'l'},
+    {"maxthreads", required_argument, NULL, 'x'},
+    {"idletimeout", required_argument, NULL, 'i'},
+    {"growwait", required_argument, NULL, 'g'},
+    {"cpubound", no_argument, NULL, 'c'},
+    {"affinity", no_argument, NULL, 'a'},
+    {"maxqueue", required_argument, NULL, 'q'},
+    {"maxwait", required_argument, NULL, 'w'},
+    {"smalllimit", required_argument, NULL, 's'},
+    {"reserved", required_argument, NULL, 'R'},
+    {"quantum", required_argument, NULL, 'Q'},
+    {"maxfds", required_argument, NULL, 'f'},
     {"delay", required_argument, NULL, 'd'},
+    {"distribution", required_argument, NULL, 'D'},
+    {"latencyfile", required_argument, NULL, 'P'},
+    {"asyncdelay", no_argument, NULL, 'A'},
     {"help", no_argument, NULL, 'h'},
     {NULL, 0, NULL, 0}};
 
 extern unsigned long int content_delay;
+extern int content_delay_async;
 
 extern gfh_error_t gfs_handler(gfcontext_t **ctx, const char *path, void *arg);
 
@@ -34,32 +67,248 @@ static void _sig_handler(int signo) {
 
 // global varibles to use
 char *content_map = "content.txt";
+
+// content_map is a compiled index rather than text
+bool content_binary = false;
+
 gfserver_t *gfs = NULL;
 int nthreads = 16;
 unsigned short port = 39474;
 int option_char = 0;
 pthread_mutex_t mutex =  PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t cond =  PTHREAD_COND_INITIALIZER;
-steque_t* work_queue;
+steque_t* work_queue; // small files
+steque_t* large_queue; // files larger than small_limit
+
+// worker pool sizing, all counters are protected by mutex
+int min_threads = 0; // 0 means same as nthreads
+int max_threads = 0; // 0 means same as nthreads
+int idle_timeout = 30; // seconds
+long grow_wait = 10000; // microseconds
+bool cpu_bound = false;
+bool pin_threads = false;
+int next_cpu_slot = 0;
+int live_threads = 0;
+int idle_threads = 0;
+
+// admission control, 0 disables the limit
+int max_queue = 0;
+int unstarted = 0; // queued requests not yet started, the ones max_queue bounds
+long max_wait = 0; // microseconds
+
+// size-aware scheduling lanes
+long small_limit = 1048576; // bytes
+int small_reserve = 1; // workers never used for large files
+int large_busy = 0;
+
+// bytes sent per turn before a transfer is requeued, 0 sends whole files
+size_t quantum = 0;
+
+// content descriptors kept open, 0 leaves the content default
+int max_fds = 0;
+
+// read content through the asynchronous backend, so simulated storage
+// delays wait on a timer instead of holding a worker
+bool async_delay = false;
+
+/* Returns the number of microseconds elapsed since the given timestamp. */
+long elapsed_usec(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000000L + (now.tv_nsec - since->tv_nsec) / 1000L;
+}
+
+/*
+ * Reloads the content map every time the process receives SIGHUP. SIGHUP is
+ * blocked in every other thread, so it is delivered here through sigwait.
+ */
+void *thread_reload_content(void *arg) {
+  sigset_t *signals = (sigset_t *)arg;
+  int signo;
+
+  while (sigwait(signals, &signo) == 0) {
+    fprintf(stderr, "Reloading content map %s\n", content_map);
+    content_reload(content_map);
+  }
+  return NULL;
+}
+
+/* Returns the number of requests waiting in either lane. Needs the mutex. */
+int queued_requests() {
+  return steque_size(work_queue) + steque_size(large_queue);
+}
+
+/* Returns the queue wait of the oldest request in either lane. Needs the mutex. */
+long oldest_wait_usec() {
+  long waited = 0;
+
+  if (!steque_isempty(work_queue))
+    waited = elapsed_usec(&((steque_request *)steque_front(work_queue))->enqueued);
+  if (!steque_isempty(large_queue)) {
+    long large_waited = elapsed_usec(&((steque_request *)steque_front(large_queue))->enqueued);
+    if (large_waited > waited)
+      waited = large_waited;
+  }
+  return waited;
+}
+
+/*
+ * Returns true if a worker may take a request right now. Small requests are
+ * always taken first; large ones only while fewer than the unreserved share
+ * of the pool is already busy with large transfers. Needs the mutex.
+ */
+bool work_available() {
+  if (!steque_isempty(work_queue))
+    return true;
+
+  int large_limit = live_threads - small_reserve;
+  if (large_limit < 1)
+    large_limit = 1;
+  return !steque_isempty(large_queue) && large_busy < large_limit;
+}
+
+/*
+ * Sends the file for a dequeued request using the given buffer. The first
+ * call looks the file up and sends the header. When a quantum is set, each
+ * call sends at most that many bytes so one slow receiver cannot hold a
+ * worker for the whole transfer. Handles file not found and error scenarios
+ * by sending the appropriate headers. Returns SERVE_DONE once the request
+ * is finished, SERVE_REQUEUE if it should be requeued to send the rest later.
+ */
+serve_result_t serve_request(steque_request *request, char *buffer) {
+  if (!request->started) {
+    // Attempt to get the file descriptor and recorded size for the requested file.
+    size_t file_len;
+    int file_descriptor = content_open(request->filepath, &file_len, &request->entry);
+    if (file_descriptor == -1) {
+      // Send file not found header if file cannot be opened.
+      gfs_sendheader(&request->context, GF_FILE_NOT_FOUND, 0);
+      return SERVE_DONE;
+    }
+
+    // Send OK header with the file size kept in the content table.
+    gfs_sendheader(&request->context, GF_OK, file_len);
+
+    request->started = true;
+    request->fildes = file_descriptor;
+    request->file_len = file_len;
+    request->offset = 0;
+    request->large = file_len > (size_t)small_limit; // later turns, if the size was not known
+  }
+
+  // Send up to one quantum, or the whole file when interleaving is off.
+  size_t stop = request->file_len;
+  if (quantum > 0 && request->offset + quantum < stop)
+    stop = request->offset + quantum;
+
+  ssize_t bts_read = 0;
+  // Continue until this turn's share of the file is sent.
+  while (request->offset < stop) { 
+    // Clear buffer and read a chunk of the file.
+    memset(buffer, '\0', BUFSIZE);
+    bts_read = content_pread(request->entry, buffer, BUFSIZE, request->offset);
+    if (bts_read <= 0) return SERVE_DONE; // Give up on read error or end of file.
+
+    // Send the read chunk to client.
+    ssize_t bts_sent = gfs_send(&request->context, buffer, bts_read);
+    if (bts_sent <= 0) return SERVE_DONE; // Give up if the client went away.
+    request->offset += bts_sent; // Update total bytes sent.
+  }
+
+  return request->offset >= request->file_len ? SERVE_DONE : SERVE_REQUEUE;
+}
+
+/*
+ * Completion of an asynchronous read, called on a content backend thread.
+ * Puts the request back in its lane so a worker sends the chunk.
+ */
+void read_done(content_read_t *read, ssize_t nread, void *arg) {
+  steque_request *request = (steque_request *)arg;
+  (void)read;
+
+  request->nread = nread;
+  pthread_mutex_lock(&mutex);
+  clock_gettime(CLOCK_MONOTONIC, &request->enqueued);
+  steque_enqueue(request->large ? large_queue : work_queue, request);
+  pthread_mutex_unlock(&mutex);
+  pthread_cond_signal(&cond);
+}
+
+/* Starts the asynchronous read of the next chunk of a request's file. */
+serve_result_t read_next(steque_request *request) {
+  size_t len = request->file_len - request->offset;
+  if (len > READ_CHUNK)
+    len = READ_CHUNK;
+
+  content_read_begin(request->entry, request->chunk, len, request->offset, read_done, request);
+  return SERVE_PENDING;
+}
+
+/*
+ * Asynchronous counterpart of serve_request. Every turn sends the chunk
+ * the last read produced and starts the next read, so a worker never waits
+ * on storage; the request comes back through read_done. The header goes
+ * out with the first chunk, after the simulated storage delay, as it would
+ * from a slow origin.
+ */
+serve_result_t serve_request_async(steque_request *request) {
+  if (!request->started) {
+    size_t file_len;
+    int file_descriptor = content_open(request->filepath, &file_len, &request->entry);
+    if (file_descriptor == -1) {
+      gfs_sendheader(&request->context, GF_FILE_NOT_FOUND, 0);
+      return SERVE_DONE;
+    }
+
+    request->started = true;
+    request->fildes = file_descriptor;
+    request->file_len = file_len;
+    request->offset = 0;
+    request->large = file_len > (size_t)small_limit; // later turns, if the size was not known
+    if (file_len == 0) {
+      gfs_sendheader(&request->context, GF_OK, 0);
+      return SERVE_DONE;
+    }
+
+    request->chunk = malloc(READ_CHUNK);
+    return read_next(request);
+  }
+
+  // Give up on read error or end of file; nothing was promised yet on the first chunk.
+  if (request->nread <= 0) {
+    if (request->offset == 0)
+      gfs_sendheader(&request->context, GF_ERROR, 0);
+    return SERVE_DONE;
+  }
+
+  if (request->offset == 0)
+    gfs_sendheader(&request->context, GF_OK, request->file_len);
+
+  ssize_t bts_sent = gfs_send(&request->context, request->chunk, request->nread);
+  if (bts_sent <= 0) return SERVE_DONE; // Give up if the client went away.
+  request->offset += bts_sent;
+
+  return request->offset >= request->file_len ? SERVE_DONE : read_next(request);
+}
 
 /*
  * Worker thread routine to handle file sending requests from a queue.
- * This function continuously processes requests from a global queue, sending
- * files to clients. It waits on a condition variable if the queue is empty. For
- * each request, it attempts to open the requested file, read its contents, and
- * send it to the client. It handles file not found and error scenarios by sending
- * appropriate headers. It ensures thread safety by locking and unlocking a mutex
- * around queue operations.
+ * This function continuously processes requests from the two size lanes,
+ * preferring small files so they never wait behind bulk transfers. It waits
+ * on a condition variable while there is no work it may take. It ensures
+ * thread safety by locking and unlocking a mutex around queue operations.
  */
 void *thread_handle_req(void *arg) {
-  // Explicitly mark unused parameter to avoid compiler warnings.
-  (void)arg;
+  // Pin to the core chosen at creation before touching any buffers, so the
+  // stack pages below are allocated on that core's NUMA node.
+  int pinned;
+  if (pin_threads && 0 != (pinned = affinity_pin((int)(intptr_t)arg)))
+    fprintf(stderr, "Unable to pin worker thread: %s\n", strerror(pinned));
 
   // Initialize buffer for file reading.
   char buffer[BUFSIZE];
 
-  // Declare variables for file information and request handling.
-  struct stat file_info;
+  // Declare variables for request handling.
   steque_request *request;
 
   // Enter an infinite loop to continuously process requests.
@@ -68,12 +317,37 @@ void *thread_handle_req(void *arg) {
     if (pthread_mutex_lock(&mutex) != 0)
       exit(12); // Exit if mutex lock fails.
 
-    // Wait for the queue to be non-empty.
-    while (steque_isempty(work_queue))
-      pthread_cond_wait(&cond, &mutex);
+    // Wait for work this thread may take, retiring if idle for too long.
+    while (!work_available()) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += idle_timeout;
+
+      idle_threads++;
+      int res = pthread_cond_timedwait(&cond, &mutex, &deadline);
+      idle_threads--;
+
+      // Shrink the pool back towards its minimum once the load is gone.
+      if (res == ETIMEDOUT && queued_requests() == 0 && live_threads > min_threads) {
+        live_threads--;
+        pthread_mutex_unlock(&mutex);
+        return NULL;
+      }
+    }
+
+    // Pop a request, shortest lane first.
+    if (!steque_isempty(work_queue)) {
+      request = steque_pop(work_queue);
+    } else {
+      request = steque_pop(large_queue);
+      large_busy++;
+    }
+    if (!request->started)
+      unstarted--;
 
-    // Pop a request from the queue.
-    request = steque_pop(work_queue);
+    // Grow the pool if this request had to wait too long for a worker.
+    long waited = elapsed_usec(&request->enqueued);
+    grow_pthreads(waited);
 
     // Unlock the mutex after accessing the queue.
     if (pthread_mutex_unlock(&mutex) != 0)
@@ -82,56 +356,90 @@ void *thread_handle_req(void *arg) {
     // Signal other threads that they may proceed to handle requests.
     pthread_cond_signal(&cond);
 
-    // Attempt to get the file descriptor for the requested file.
-    int file_descriptor = content_get(request->filepath);
-    if (file_descriptor == -1) {
-      // Send file not found header if file cannot be opened.
-      gfs_sendheader(&request->context, GF_FILE_NOT_FOUND, 0);
-      //free(req);
-      continue;
-    }
-
-    // Get file statistics; check for errors.
-    if (fstat(file_descriptor, &file_info) == -1) {
-      // Send error header if file stats cannot be obtained.
+    // Shed requests that are already stale rather than serving them late.
+    // Requests that were requeued mid-transfer have already been admitted.
+    // A pending read may requeue the request to another worker, which can
+    // free it before this one gets back to it, so note its lane first.
+    bool large = request->large;
+    serve_result_t result = SERVE_DONE;
+    if (!request->started && max_wait > 0 && waited > max_wait) {
       gfs_sendheader(&request->context, GF_ERROR, 0);
-      close(file_descriptor); // Close the file descriptor.
-      //free(req); // Free request memory.
-      continue;
+    } else if (async_delay) {
+      result = serve_request_async(request);
+    } else {
+      result = serve_request(request, buffer);
     }
 
-    // Send OK header with file size if file is successfully opened and stats obtained.
-    gfs_sendheader(&request->context, GF_OK, file_info.st_size);
-
-    // Initialize variables for sending file content.
-    size_t total_bts_sent = 0;
-    ssize_t bts_read = 0;
-    // Continue until entire file is sent.
-    while (total_bts_sent < (size_t)file_info.st_size) { 
-      // Clear buffer and read a chunk of the file.
-      memset(buffer, '\0', BUFSIZE);
-      bts_read = pread(file_descriptor, buffer, BUFSIZE, total_bts_sent);
-      if (bts_read <= 0) break; // Break loop if read error or end of file.
-
-      // Send the read chunk to client.
-      ssize_t bts_sent = gfs_send(&request->context, buffer, bts_read);
-      total_bts_sent += bts_sent; // Update total bytes sent.
+    // Give the large lane slot back so a waiting bulk transfer can start,
+    // and put an unfinished transfer at the back of its lane.
+    if (large || result == SERVE_REQUEUE) {
+      pthread_mutex_lock(&mutex);
+      if (large)
+        large_busy--;
+      if (result == SERVE_REQUEUE) {
+        clock_gettime(CLOCK_MONOTONIC, &request->enqueued);
+        steque_enqueue(request->large ? large_queue : work_queue, request);
+      }
+      pthread_mutex_unlock(&mutex);
+      pthread_cond_signal(&cond);
     }
 
-    // Cleanup: free the request memory.
-    free(request);
+    // Cleanup: release the content entry and free the request once it is finished.
+    if (result == SERVE_DONE) {
+      content_close(request->entry);
+      free(request->chunk);
+      free(request);
+    }
   }
-  free(request);
   // Function signature requires return statement; return NULL for pthread compatibility.
   return NULL;
 }
 
 
 /*
- * Initializes a mutex and creates a specified number of worker threads.
- * This function initializes a global mutex used for synchronization across threads.
- * It then dynamically allocates memory for storing thread identifiers and creates
- * 'nthreads' worker threads, each executing the 'thread_handle_req' function.
+ * Creates one detached worker thread and accounts for it in the pool.
+ * Must be called with the mutex held. Returns 0 on success.
+ */
+int spawn_pthread() {
+  pthread_t thread;
+  pthread_attr_t attr;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int res = pthread_create(&thread, &attr, thread_handle_req, (void *)(intptr_t)next_cpu_slot);
+  pthread_attr_destroy(&attr);
+
+  if (res == 0) {
+    live_threads++;
+    next_cpu_slot = (next_cpu_slot + 1) % affinity_ncpus();
+  }
+  return res;
+}
+
+/*
+ * Adds a worker thread when requests are queueing up faster than the
+ * current pool drains them, as seen by a request that waited 'waited'
+ * microseconds. Growth stops at max_threads, and a failure to
+ * create the thread simply leaves the pool at its current size.
+ * Must be called with the mutex held.
+ */
+void grow_pthreads(long waited) {
+  if (waited < grow_wait || live_threads >= max_threads)
+    return;
+
+  // Idle threads that have been signalled will pick the backlog up.
+  if (queued_requests() <= idle_threads)
+    return;
+
+  spawn_pthread();
+}
+
+/*
+ * Initializes a mutex and creates the initial set of worker threads.
+ * This function initializes a global mutex used for synchronization across threads
+ * and creates 'nthreads' detached worker threads, each executing the
+ * 'thread_handle_req' function. The pool later grows towards max_threads
+ * under load and shrinks back to min_threads when idle.
  * If any step fails, the function exits with a specific error code, default 1.
  */
 void set_pthreads(size_t nthreads) {
@@ -141,28 +449,18 @@ void set_pthreads(size_t nthreads) {
     exit(1); // Specific exit code for mutex initialization failure
   }
 
-  // Dynamically allocate memory for thread identifiers
-  pthread_t* threads = malloc(nthreads * sizeof(pthread_t));
-  if (threads == NULL) {
-    // Clean up resources and exit if memory allocation fails
-    pthread_mutex_destroy(&mutex);
-    exit(EXIT_FAILURE); // Use standard exit code for allocation failure
-  }
-
   // Create worker threads
+  pthread_mutex_lock(&mutex);
   for (size_t i = 0; i < nthreads; i++) {
-    res = pthread_create(&threads[i], NULL, thread_handle_req, NULL);
+    res = spawn_pthread();
     if (res != 0) {
-      // Clean up allocated memory and initialized mutex before exiting
-      free(threads);
+      // Clean up initialized mutex before exiting
+      pthread_mutex_unlock(&mutex);
       pthread_mutex_destroy(&mutex);
       exit(1); // Specific exit code for thread creation failure
     }
   }
-
-  // Free the allocated memory for thread identifiers
-  // Assuming threads are either joined or detached later in the program
-  free(threads);
+  pthread_mutex_unlock(&mutex);
 }
 
 /* Main ========================================================= */
@@ -187,7 +485,7 @@ int main(int argc, char **argv) {
   }
 
   // Parse and set command line arguments
-  while ((option_char = getopt_long(argc, argv, "p:d:rhm:t:", gLongOptions,
+  while ((option_char = getopt_long(argc, argv, "p:d:rhm:bt:l:x:i:g:caq:w:s:R:Q:f:D:P:A", gLongOptions,
                                     NULL)) != -1) {
     switch (option_char) {
       case 'h':  /* help */
@@ -206,6 +504,59 @@ int main(int argc, char **argv) {
       case 'm':  /* file-path */
         content_map = optarg;
         break;
+      case 'b':  /* binary */
+        content_binary = true;
+        break;
+      case 'l':  /* min-threads */
+        min_threads = atoi(optarg);
+        break;
+      case 'x':  /* max-threads */
+        max_threads = atoi(optarg);
+        break;
+      case 'i':  /* idle-timeout */
+        idle_timeout = atoi(optarg);
+        break;
+      case 'g':  /* grow-wait */
+        grow_wait = atol(optarg);
+        break;
+      case 'c':  /* cpu-bound */
+        cpu_bound = true;
+        break;
+      case 'a':  /* affinity */
+        pin_threads = true;
+        break;
+      case 'q':  /* max-queue */
+        max_queue = atoi(optarg);
+        break;
+      case 'w':  /* max-wait */
+        max_wait = atol(optarg);
+        break;
+      case 's':  /* small-limit */
+        small_limit = atol(optarg);
+        break;
+      case 'R':  /* reserved */
+        small_reserve = atoi(optarg);
+        break;
+      case 'Q':  /* quantum */
+        quantum = (size_t)atol(optarg);
+        break;
+      case 'f':  /* max-fds */
+        max_fds = atoi(optarg);
+        break;
+      case 'D':  /* distribution */
+        if (latency_distribution(optarg) < 0) {
+          fprintf(stderr, "%s", USAGE);
+          exit(1);
+        }
+        break;
+      case 'P':  /* latency-file */
+        if (latency_rules(optarg) < 0) {
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'A':  /* async-delay */
+        async_delay = true;
+        break;
       default:
         fprintf(stderr, "%s", USAGE);
         exit(1);
@@ -219,18 +570,76 @@ int main(int argc, char **argv) {
     nthreads = 1;
   }
 
+  /* pool bounds default to a fixed pool of nthreads */
+  if (min_threads < 1 || min_threads > nthreads) {
+    min_threads = nthreads;
+  }
+  if (max_threads < nthreads) {
+    max_threads = nthreads;
+  }
+  if (max_threads > MAX_THREADS) {
+    max_threads = MAX_THREADS;
+  }
+
+  /* CPU-bound work gains nothing from more threads than cores; blocking
+     disk I/O is allowed to go past that */
+  int ncpus = affinity_ncpus();
+  if (cpu_bound) {
+    if (nthreads > ncpus)
+      nthreads = ncpus;
+    if (min_threads > ncpus)
+      min_threads = ncpus;
+    if (max_threads > ncpus)
+      max_threads = ncpus;
+  }
+
+  if (idle_timeout < 1) {
+    idle_timeout = 1;
+  }
   if (content_delay > 5000000) {
     fprintf(stderr, "Content delay must be less than 5000000 (microseconds)\n");
     exit(__LINE__);
   }
 
-  content_init(content_map);
+  /* Block SIGHUP before any thread starts so only the reload thread sees it */
+  static sigset_t reload_signals;
+  sigemptyset(&reload_signals);
+  sigaddset(&reload_signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &reload_signals, NULL);
+
+  if (max_fds > 0) {
+    content_set_maxfds(max_fds);
+  }
+  if (content_binary) {
+    content_init_binary(content_map);
+  } else {
+    content_init(content_map);
+  }
+  content_watch();
+
+  pthread_t reload_thread;
+  if (pthread_create(&reload_thread, NULL, thread_reload_content, &reload_signals) != 0) {
+    fprintf(stderr, "Can't start the content reload thread...exiting.\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_detach(reload_thread);
 
   /* Initialize thread management */
   work_queue = (steque_t*)malloc(sizeof(*work_queue));
   steque_init(work_queue);
+  large_queue = (steque_t*)malloc(sizeof(*large_queue));
+  steque_init(large_queue);
   set_pthreads(nthreads);
 
+  /* Delays move into the read backend, so lookups themselves must not sleep */
+  if (async_delay) {
+    content_delay_async = 1;
+    if (content_backend("delay", IO_THREADS) != 0) {
+      fprintf(stderr, "Can't start the content backend...exiting.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
   /*Initializing server*/
   gfs = gfserver_create();
 
@@ -6,7 +6,11 @@
 
 extern pthread_mutex_t mutex;
 extern steque_t* work_queue;
+extern steque_t* large_queue;
 extern pthread_cond_t cond;
+extern int max_queue;
+extern int unstarted;
+extern long small_limit;
 
 //
 //  The purpose of this function is to handle a get request
@@ -18,6 +22,15 @@ extern pthread_cond_t cond;
 //        not in others.
 //
 gfh_error_t gfs_handler(gfcontext_t **ctx, const char *path, void* arg) {
+    // Unknown keys are mostly rejected by the content Bloom filter, and the
+    // rest by the exact lookup behind it. Neither opens a file, so answer
+    // them right here instead of spending a queue slot and a worker on them
+    ssize_t size = content_size(path);
+    if (size == -1) {
+        gfs_sendheader(ctx, GF_FILE_NOT_FOUND, 0);
+        return gfh_success;
+    }
+
 	// Allocate and initialize the request structure
 	steque_request* req = (steque_request*)malloc(sizeof(*req));
 	if (req == NULL) {
@@ -27,15 +40,38 @@ gfh_error_t gfs_handler(gfcontext_t **ctx, const char *path, void* arg) {
     req->context = *ctx;
     req->filepath = path;
     req->arg = arg;
+    req->started = false;
+    req->entry = NULL;
+    req->chunk = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &req->enqueued);
+
+    // Route by the size kept in the content table. A file never opened has
+    // no size yet; the worker that opens it moves it to its lane, so this
+    // thread never waits on the disk
+    req->large = size > small_limit;
     
     // Lock mutex before modifying the queue
     if (pthread_mutex_lock(&mutex) != 0) {
         free(req); // Ensure to free allocated memory on error
         return gfh_failure;
     }
+
+    // Shed load once the queue is full: a fast ERROR keeps latency bounded
+    // for the requests already admitted. Transfers requeued between quanta
+    // were admitted already and do not count
+    if (max_queue > 0 && unstarted >= max_queue) {
+        pthread_mutex_unlock(&mutex);
+        free(req);
+        gfs_sendheader(ctx, GF_ERROR, 0);
+        return gfh_success;
+    }
     
     // Enqueue the request
-    steque_enqueue(work_queue, req);
+    steque_enqueue(req->large ? large_queue : work_queue, req);
+    unstarted++;
+
+    // Grow the worker pool if the oldest queued request has waited too long
+    grow_pthreads(oldest_wait_usec());
     
     // Unlock mutex after modification
     if (pthread_mutex_unlock(&mutex) != 0) {
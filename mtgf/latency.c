@@ -0,0 +1,119 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+
+typedef enum{
+	LATENCY_FIXED,
+	LATENCY_EXPONENTIAL,
+	LATENCY_LOGNORMAL
+} latency_dist_t;
+
+typedef struct{
+	char *prefix;
+	size_t len;
+	unsigned long mean;
+} rule_t;
+
+/* Configured once at startup, before any worker runs */
+static latency_dist_t dist = LATENCY_FIXED;
+static double sigma = 1.0;
+static rule_t *rules;
+static int nrules;
+
+int latency_distribution(const char *spec){
+	if(0 == strcmp(spec, "fixed"))
+		dist = LATENCY_FIXED;
+	else if(0 == strcmp(spec, "exp"))
+		dist = LATENCY_EXPONENTIAL;
+	else if(0 == strncmp(spec, "lognormal", 9) && ('\0' == spec[9] || ':' == spec[9])){
+		dist = LATENCY_LOGNORMAL;
+		if(':' == spec[9])
+			sigma = atof(spec + 10);
+	}else
+		return -1;
+
+	return 0;
+}
+
+int latency_rules(const char *filename){
+	char *line = NULL, *ptr, *prefix, *mean;
+	size_t linecap = 0;
+	int capacity = 0;
+	ssize_t len;
+	FILE *in;
+
+	if( NULL == (in = fopen(filename, "r"))){
+		fprintf(stderr, "Unable to open latency rules %s.\n", filename);
+		return -1;
+	}
+
+	while( 0 < (len = getline(&line, &linecap, in))){
+		while(len > 0 && ('\n' == line[len - 1] || '\r' == line[len - 1]))
+			line[--len] = '\0';
+
+		ptr = line;
+		prefix = strsep(&ptr, " \t");
+		mean = strsep(&ptr, " \t");
+		if(NULL == mean || '\0' == *prefix){
+			if('\0' != *line)
+				fprintf(stderr, "Skipping malformed latency rule %s.\n", line);
+			continue;
+		}
+
+		if(nrules == capacity){
+			capacity = capacity ? capacity * 2 : 8;
+			rules = realloc(rules, capacity * sizeof(rule_t));
+		}
+		rules[nrules].prefix = strdup(prefix);
+		rules[nrules].len = strlen(prefix);
+		rules[nrules].mean = strtoul(mean, NULL, 10);
+		nrules++;
+	}
+	free(line);
+	fclose(in);
+
+	return 0;
+}
+
+/* Uniform in (0, 1) from a per-thread generator */
+static double _uniform(){
+	static __thread unsigned int seed = 0;
+
+	if(0 == seed)
+		seed = (unsigned int) time(NULL) ^ (unsigned int) (uintptr_t) &seed;
+	return (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+}
+
+unsigned long latency_sample(const char *key, unsigned long mean){
+	double delay, z;
+	int i;
+
+	for(i = 0; i < nrules; i++)
+		if(0 == strncmp(key, rules[i].prefix, rules[i].len)){
+			mean = rules[i].mean;
+			break;
+		}
+
+	if(0 == mean)
+		return 0;
+
+	switch(dist){
+		case LATENCY_EXPONENTIAL:
+			delay = -log(_uniform()) * mean;
+			break;
+		case LATENCY_LOGNORMAL:
+			/* Box-Muller; mu is chosen so the mean stays at mean */
+			z = sqrt(-2.0 * log(_uniform())) * cos(2.0 * M_PI * _uniform());
+			delay = exp(log(mean) - sigma * sigma / 2.0 + sigma * z);
+			break;
+		default:
+			delay = mean;
+	}
+
+	return delay > LATENCY_MAX_USEC ? LATENCY_MAX_USEC : (unsigned long) delay;
+}
@@ -0,0 +1,32 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+/*
+ * Simulated storage latency for capacity testing.  Each lookup of an
+ * existing key draws a delay from a distribution around a mean, which is
+ * content_delay unless a per-path rule gives the key its own.
+ */
+
+/*
+ * Selects the distribution delays are drawn from: "fixed" (the default),
+ * "exp" or "lognormal[:sigma]" (sigma of the underlying normal, default 1).
+ * Returns -1 if the name is not recognized.
+ */
+int latency_distribution(const char *spec);
+
+/*
+ * Loads per-path mean delays from filename.  Each line holds a key prefix
+ * and a mean in microseconds separated by a space; the first matching
+ * prefix applies.  Returns -1 if the file cannot be read.
+ */
+int latency_rules(const char *filename);
+
+/*
+ * Returns a delay in microseconds for key, drawn around mean unless a
+ * rule matches.  Never more than LATENCY_MAX_USEC.
+ */
+unsigned long latency_sample(const char *key, unsigned long mean);
+
+#define LATENCY_MAX_USEC 5000000UL
+
+#endif
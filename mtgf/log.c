@@ -0,0 +1,205 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define LOG_RING_SIZE (64 * 1024)	/* per thread, a power of two */
+#define LOG_RECORD_MAX 1024	/* longer records are truncated */
+#define LOG_BATCH_SIZE (64 * 1024)
+#define LOG_FLUSH_USEC 10000
+
+/*
+ * Single-producer single-consumer ring. Only the owning thread advances
+ * head and only the writer thread advances tail; both only grow, and the
+ * difference is the number of bytes waiting.
+ */
+typedef struct log_ring{
+	char data[LOG_RING_SIZE];
+	size_t head;
+	size_t tail;
+	int exited;	/* owner gone: reusable once drained */
+	struct log_ring *next;
+} log_ring_t;
+
+static log_ring_t *rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static __thread log_ring_t *my_ring;
+
+static int log_fd = -1;
+static int stopping;
+static pthread_t writer;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+
+static void _writeall(const char *data, size_t len){
+	ssize_t written;
+
+	while(len > 0){
+		if(0 > (written = write(log_fd, data, len))){
+			if(EINTR == errno)
+				continue;
+			return;
+		}
+		data += written;
+		len -= written;
+	}
+}
+
+/* Copies what ring holds into batch and returns the new batch length. Writer only. */
+static size_t _drain(log_ring_t *ring, char *batch, size_t used){
+	size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	size_t tail = ring->tail;
+	size_t offset, chunk;
+
+	while(tail != head){
+		if(used == LOG_BATCH_SIZE){
+			_writeall(batch, used);
+			used = 0;
+		}
+		offset = tail & (LOG_RING_SIZE - 1);
+		chunk = head - tail;
+		if(chunk > LOG_RING_SIZE - offset)
+			chunk = LOG_RING_SIZE - offset;
+		if(chunk > LOG_BATCH_SIZE - used)
+			chunk = LOG_BATCH_SIZE - used;
+		memcpy(batch + used, ring->data + offset, chunk);
+		used += chunk;
+		tail += chunk;
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+	return used;
+}
+
+/* Writes out every ring once. Writer only. */
+static void _drainall(char *batch){
+	size_t used = 0;
+	log_ring_t *ring;
+
+	pthread_mutex_lock(&rings_lock);
+	for(ring = rings; ring; ring = ring->next)
+		used = _drain(ring, batch, used);
+	pthread_mutex_unlock(&rings_lock);
+
+	if(used > 0)
+		_writeall(batch, used);
+}
+
+static void *_writeloop(void *arg){
+	static char batch[LOG_BATCH_SIZE];
+	struct timespec deadline;
+
+	(void) arg;
+	pthread_mutex_lock(&writer_lock);
+	while(!stopping){
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += LOG_FLUSH_USEC * 1000;
+		if(deadline.tv_nsec >= 1000000000){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&writer_cond, &writer_lock, &deadline);
+
+		pthread_mutex_unlock(&writer_lock);
+		_drainall(batch);
+		pthread_mutex_lock(&writer_lock);
+	}
+	pthread_mutex_unlock(&writer_lock);
+
+	/* Final pass once every producer that is going to write has written */
+	_drainall(batch);
+	return NULL;
+}
+
+static void _ringexit(void *ring){
+	__atomic_store_n(&((log_ring_t*) ring)->exited, 1, __ATOMIC_RELEASE);
+}
+
+/* Returns the calling thread's ring, adopting a drained one of an exited thread if any */
+static log_ring_t *_myring(){
+	log_ring_t *ring;
+
+	if(NULL != my_ring)
+		return my_ring;
+
+	pthread_mutex_lock(&rings_lock);
+	for(ring = rings; ring; ring = ring->next)
+		if(__atomic_load_n(&ring->exited, __ATOMIC_ACQUIRE) &&
+				__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head)
+			break;
+	if(NULL != ring){
+		ring->exited = 0;
+	}else{
+		ring = (log_ring_t*) calloc(1, sizeof(log_ring_t));
+		ring->next = rings;
+		rings = ring;
+	}
+	pthread_mutex_unlock(&rings_lock);
+
+	pthread_setspecific(ring_key, ring);
+	my_ring = ring;
+	return ring;
+}
+
+static void _shutdown(){
+	pthread_mutex_lock(&writer_lock);
+	stopping = 1;
+	pthread_mutex_unlock(&writer_lock);
+	pthread_cond_signal(&writer_cond);
+	pthread_join(writer, NULL);
+}
+
+void log_init(int fd){
+	log_fd = fd;
+	pthread_key_create(&ring_key, _ringexit);
+	if(0 != pthread_create(&writer, NULL, _writeloop, NULL)){
+		log_fd = -1;
+		return;
+	}
+	atexit(_shutdown);
+}
+
+void log_write(const char *format, ...){
+	char record[LOG_RECORD_MAX];
+	log_ring_t *ring;
+	size_t len, head, offset, chunk;
+	va_list args;
+	int n;
+
+	va_start(args, format);
+	if(0 > log_fd){
+		vfprintf(MYLOG_FILE, format, args);
+		va_end(args);
+		return;
+	}
+	n = vsnprintf(record, sizeof(record), format, args);
+	va_end(args);
+	if(n < 0)
+		return;
+	len = (size_t) n < sizeof(record) ? (size_t) n : sizeof(record) - 1;
+
+	/* A truncated line keeps its newline, so it does not run into the next record */
+	if(len < (size_t) n && len > 0 && '\n' == format[strlen(format) - 1])
+		record[len - 1] = '\n';
+
+	ring = _myring();
+	head = ring->head;
+
+	/* Full: wake the writer and wait for room rather than drop the record */
+	while(LOG_RING_SIZE - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < len){
+		pthread_cond_signal(&writer_cond);
+		usleep(1000);
+	}
+
+	offset = head & (LOG_RING_SIZE - 1);
+	chunk = len < LOG_RING_SIZE - offset ? len : LOG_RING_SIZE - offset;
+	memcpy(ring->data + offset, record, chunk);
+	memcpy(ring->data, record + chunk, len - chunk);
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+}
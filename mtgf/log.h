@@ -11,10 +11,29 @@
 
 #ifndef MYLOG_PRIORITY
 #define MYLOG_PRIORITY 1
-#endif 
+#endif
 
 #define MYLOG_FILE stderr
 
-#define L(priority,format,a...) if(priority <= MYLOG_PRIORITY) fprintf(MYLOG_FILE, format "\n", ## a);
+/*
+ * Logs a line at the given priority.  Priorities above MYLOG_PRIORITY are
+ * constant-false and compile out, arguments included.  Records are
+ * formatted into a ring buffer owned by the calling thread and written
+ * out in batches by a background thread once log_init has been called;
+ * before that they go straight to MYLOG_FILE.
+ */
+#define L(priority,format,a...) do { if((priority) <= MYLOG_PRIORITY) log_write(format "\n", ## a); } while(0)
 
-#endif 
+/*
+ * Starts the background thread that writes all records to fd.  Whatever
+ * is still buffered is written when the process exits.
+ */
+void log_init(int fd);
+
+/*
+ * Appends one formatted record to the calling thread's ring buffer.
+ * Waits for the writer if the ring is full, so no record is dropped.
+ */
+void log_write(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif